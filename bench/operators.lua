@@ -0,0 +1,35 @@
+-- Times the arithmetic and comparison operators on mpfr values, run as `lua
+-- bench/operators.lua [n]` with the module on package.cpath (e.g. after
+-- `luarocks make`).  Prints the best time per operation in nanoseconds out
+-- of 5 runs of n operations each.
+
+local mpfr = require 'mpfr'
+
+local n = tonumber(arg and arg[1]) or 1000000
+local x, y = (mpfr.fr(1)) / 3, (mpfr.fr(2)):sqrt()
+local z = (mpfr.complex(1, 2))
+
+local cases = {
+	{'fr + fr', function() return x + y end},
+	{'fr - fr', function() return x - y end},
+	{'fr * fr', function() return x * y end},
+	{'fr / fr', function() return x / y end},
+	{'fr + int', function() return x + 3 end},
+	{'int - fr', function() return 3 - x end},
+	{'fr * float', function() return x * 0.5 end},
+	{'-fr', function() return -x end},
+	{'fr < fr', function() return x < y end},
+	{'fr == fr', function() return x == y end},
+	{'fr + complex', function() return x + z end},
+}
+
+for _, case in ipairs(cases) do
+	local f, best = case[2], math.huge
+	for _ = 1, 5 do
+		collectgarbage()
+		local t = os.clock()
+		for _ = 1, n do f() end
+		best = math.min(best, os.clock() - t)
+	end
+	print(string.format('%-14s %7.1f ns', case[1], best / n * 1e9))
+end
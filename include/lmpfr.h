@@ -0,0 +1,82 @@
+/* C interface to the Lua binding for GNU MPFR.
+ *
+ * Native modules can use this to accept and return the binding's mpfr
+ * values directly.  The binding publishes a struct lmpfr of function
+ * pointers in the registry when loaded; lmpfr_load fetches it, loading
+ * "mpfr.core" if necessary, and should be called once, with the result
+ * kept for later calls (for example, in an upvalue of the module's
+ * functions); it stays valid as long as the Lua state.  The struct only
+ * ever grows, so code built against this header works with any binding of
+ * the same or a later LMPFR_VERSION.  Values of the LuaJIT FFI
+ * implementation mpfr.ffi are cdata, not userdata, and are not accepted. */
+
+#ifndef LMPFR_H
+#define LMPFR_H
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "gmp.h"
+#include "mpfr.h"
+
+#define LMPFR_VERSION 1
+
+/* registry fields: the struct lmpfr as a light userdata, the module
+ * table, and the metatables of mpfr values and (if LGMP was found) of mpz
+ * and mpf ones */
+#define LMPFR_REGISTRY "lmpfr"
+#define LMPFR_MODULE   "lmpfr.module"
+#define LMPFR_FRMETA   "lmpfr.fr"
+#define LMPFR_ZMETA    "lmpfr.z"
+#define LMPFR_FMETA    "lmpfr.f"
+
+struct lmpfr {
+	int version;
+	/* the mpfr value at idx, or NULL (test) or an error (check) if none */
+	mpfr_t *(*test)(lua_State *L, int idx);
+	mpfr_t *(*check)(lua_State *L, int idx);
+	/* push a new mpfr value of the given precision (0 for the default),
+	 * set to NaN, or a copy of op */
+	mpfr_t *(*create)(lua_State *L, mpfr_prec_t prec);
+	mpfr_t *(*push)(lua_State *L, mpfr_srcptr op);
+	/* the LGMP mpz or mpf value at idx, or NULL if none */
+	mpz_t *(*testz)(lua_State *L, int idx);
+	mpf_t *(*testf)(lua_State *L, int idx);
+	/* set rop from the mpfr, mpz, mpf or number at idx, return the
+	 * ternary value; an error for anything else */
+	int (*set)(lua_State *L, int idx, mpfr_ptr rop, mpfr_rnd_t rnd);
+};
+
+#if defined(__cplusplus) || defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define LMPFR_INLINE static inline
+#else
+#define LMPFR_INLINE static
+#endif
+
+LMPFR_INLINE const struct lmpfr *lmpfr_load(lua_State *L) {
+	const struct lmpfr *api;
+	lua_getfield(L, LUA_REGISTRYINDEX, LMPFR_REGISTRY);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_getglobal(L, "require");
+		lua_pushstring(L, "mpfr.core");
+		lua_call(L, 1, 0);
+		lua_getfield(L, LUA_REGISTRYINDEX, LMPFR_REGISTRY);
+	}
+	api = (const struct lmpfr *)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	if (!api || api->version < LMPFR_VERSION)
+		luaL_error(L, "lmpfr C interface version %d required", LMPFR_VERSION);
+	return api;
+}
+
+/* shorthands taking the result A of lmpfr_load */
+#define lmpfr_test(A, L, I)         ((A)->test((L), (I)))
+#define lmpfr_check(A, L, I)        ((A)->check((L), (I)))
+#define lmpfr_new(A, L, P)          ((A)->create((L), (P)))
+#define lmpfr_push(A, L, X)         ((A)->push((L), (X)))
+#define lmpfr_testz(A, L, I)        ((A)->testz((L), (I)))
+#define lmpfr_testf(A, L, I)        ((A)->testf((L), (I)))
+#define lmpfr_set(A, L, I, X, R)    ((A)->set((L), (I), (X), (R)))
+
+#endif
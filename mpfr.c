@@ -1,7 +1,21 @@
 #include <ctype.h>
 #include <limits.h>
+#include <math.h>
+#include <stdint.h> /* before mpfr.h, for the intmax_t functions */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(LMPFR_NO_THREADS)
+#define LMPFR_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef LMPFR_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#endif
 
 #include "lua.h"
 #include "lauxlib.h"
@@ -9,11 +23,59 @@
 #include "gmp.h"
 #include "mpfr.h"
 
+#include "lmpfr.h"
+
+enum {
+	FRMETA = 1, ZMETA, /* FIXME Q, */ FMETA, CTX, STATE, APMETA, CXMETA,
+	NUPP1, NUP = NUPP1 - 1,
+};
+
+/* precision and rounding mode bound by mpfr.context, nil for the module */
+struct context {
+	mpfr_prec_t prec;
+	mpfr_rnd_t  rnd;
+};
+
+#define toctx(L) ((struct context *)lua_touserdata((L), lua_upvalueindex(CTX)))
+
+/* functions whose values can be memoized, see memo */
 enum {
-	FRMETA = 1, ZMETA, /* FIXME Q, */ FMETA, NUPP1, NUP = NUPP1 - 1,
+	MGAMMA, MLNGAMMA, MDIGAMMA, MZETA, MZETAUI, MJN, MYN,
+};
+
+struct memo {
+	struct entry **buckets, *first, *last; /* by hash, by time of use */
+	size_t nbucket, count, capacity;
+	unsigned long hits, misses;
+};
+
+/* per-module C-side caches, freed with the module */
+struct state {
+	struct lmpfr api; /* first, published in the registry, see apistate */
+	struct rule *rules; /* quadrature nodes, see integrate */
+	struct memo memo;
+	const void *meta[4]; /* FRMETA, ZMETA, FMETA and CXMETA, see metatype */
+	int nthread, tls; mpfr_prec_t threshold; /* see set_threads */
 };
 
+#define tostate(L) ((struct state *)lua_touserdata((L), lua_upvalueindex(STATE)))
+
+/* USDT probes lmpfr:entry and lmpfr:exit around every function (see traced),
+ * and lmpfr:new and lmpfr:gc for mpfr values, each enabled by a semaphore */
+#ifdef LMPFR_SDT
+#define SEMAPHORE(N) __extension__ unsigned short lmpfr_ ## N ## _semaphore \
+	__attribute__((unused)) __attribute__((section(".probes")))
+SEMAPHORE(entry); SEMAPHORE(exit); SEMAPHORE(new); SEMAPHORE(gc);
+#define PROBED(N) (lmpfr_ ## N ## _semaphore)
+#define PROBE1(N, A) do { \
+	if (PROBED(N)) DTRACE_PROBE1(lmpfr, N, A); \
+} while (0)
+#else
+#define PROBE1(N, A) ((void)0)
+#endif
+
 #if LUA_VERSION_NUM < 502
+#define lua_rawlen(L, I) lua_objlen((L), (I))
 #define typerror(L, A, T) luaL_typerror((L), (A), (T))
 #else
 int typerror(lua_State *L, int narg, const char *tname) {
@@ -23,8 +85,15 @@ int typerror(lua_State *L, int narg, const char *tname) {
 }
 #endif
 
+/* without the user value that lua_newuserdata adds in 5.4 */
+#if LUA_VERSION_NUM < 504
+#define newudata(L, S) lua_newuserdata((L), (S))
+#else
+#define newudata(L, S) lua_newuserdatauv((L), (S), 0)
+#endif
+
 enum {
-	FR = 0, Z, F, UI, SI, /* FIXME NI, */ D, NIL, STR, UNK,
+	FR = 0, Z, F, UI, SI, /* FIXME NI, */ D, NIL, STR, CX /* see metatype */, UNK,
 };
 
 static int type(lua_State *L, int idx) {
@@ -120,14 +189,23 @@ static const char opts[] = "AUDYZNF";
 static const mpfr_rnd_t rnds[] =
 	{MPFR_RNDA, MPFR_RNDU, MPFR_RNDD, MPFR_RNDA, MPFR_RNDZ, MPFR_RNDN, MPFR_RNDF};
 
+/* the index in rnds of the rounding mode named by opt, or -1 */
+static int findrnd(const char *opt) {
+	const char *optp;
+	if (!opt[0] || opt[1] || !(optp = strchr(opts, toupper((unsigned char)opt[0]))))
+		return -1;
+	return optp - opts;
+}
+
 static mpfr_rnd_t checkrnd(lua_State *L, int idx) {
-	const char *opt, *optp;
-	if (lua_isnil(L, idx))
-		return mpfr_get_default_rounding_mode();
-	opt = luaL_checkstring(L, idx);
-	luaL_argcheck(L, opt[0] && !opt[1] && (optp = strchr(opts, toupper((unsigned char)opt[0]))),
-	              idx, lua_pushfstring(L, "invalid rounding mode"));
-	return rnds[optp - opts];
+	int i;
+	if (lua_isnil(L, idx)) {
+		struct context *ctx = toctx(L);
+		return ctx ? ctx->rnd : mpfr_get_default_rounding_mode();
+	}
+	i = findrnd(luaL_checkstring(L, idx));
+	luaL_argcheck(L, i >= 0, idx, "invalid rounding mode");
+	return rnds[i];
 }
 
 static mpfr_rnd_t settoprnd(lua_State *L, int low, int idx) {
@@ -148,13 +226,21 @@ static mpfr_rnd_t settoprnd(lua_State *L, int low, int idx) {
 /* .1 Initialization functions */
 
 static mpfr_t *newfr(lua_State *L) {
-	mpfr_t *p = lua_newuserdata(L, sizeof *p);
-	mpfr_init(*p);
+	struct context *ctx = toctx(L);
+	mpfr_t *p = newudata(L, sizeof *p);
+	if (ctx) mpfr_init2(*p, ctx->prec); else mpfr_init(*p);
+	PROBE1(new, (long)mpfr_get_prec(*p));
 	lua_pushvalue(L, lua_upvalueindex(FRMETA));
 	lua_setmetatable(L, -2);
 	return p;
 }
 
+static mpfr_t *newtmp(lua_State *L, mpfr_prec_t prec) {
+	mpfr_t *p = newfr(L);
+	mpfr_set_prec(*p, prec);
+	return p;
+}
+
 static mpfr_t *checkfropt(lua_State *L, int idx) {
 	mpfr_t *p;
 	if (!lua_isnil(L, idx))
@@ -196,6 +282,22 @@ static mpfr_t *checkfropt(lua_State *L, int idx) {
 	return pushter(L, mpfr_ ## F (*res, *self, *other, rnd)); \
 } while (0)
 
+static int memo(lua_State *L, int fn, mpfr_ptr res,
+                long n, mpfr_srcptr x, mpfr_rnd_t rnd);
+
+static int pmul(const struct state *st, mpfr_ptr rop,
+                mpfr_srcptr x, mpfr_srcptr y, mpfr_rnd_t rnd);
+static int pdiv(const struct state *st, mpfr_ptr rop,
+                mpfr_srcptr x, mpfr_srcptr y, mpfr_rnd_t rnd);
+static int psqrt(const struct state *st, mpfr_ptr rop,
+                 mpfr_srcptr x, mpfr_rnd_t rnd);
+
+#define MUNF(L, F) do { \
+	mpfr_rnd_t rnd = settoprnd(L, 0, 2); \
+	mpfr_t *self = checkfr(L, 1), *res = checkfropt(L, 2); \
+	return pushter(L, memo(L, F, *res, 0, *self, rnd)); \
+} while (0)
+
 static int set(lua_State *L);
 
 static int fr(lua_State *L) {
@@ -207,6 +309,7 @@ static int fr(lua_State *L) {
 
 static int meth_gc(lua_State *L) {
 	mpfr_t *p = checkfr(L, 1);
+	PROBE1(gc, (long)mpfr_get_prec(*p));
 	mpfr_clear(*p); return 0;
 }
 
@@ -267,6 +370,32 @@ static int set(lua_State *L) {
 	return 1;
 }
 
+/* the precision that holds the numeric argument at idx exactly, or 0 */
+static mpfr_prec_t exactprec(lua_State *L, int idx) {
+	mpfr_prec_t prec;
+	switch (type(L, idx)) {
+	case FR: return mpfr_get_prec(tofr(L, idx));
+	case Z:  prec = mpz_sizeinbase(toz(L, idx), 2); break;
+	case F:  prec = mpf_get_prec(tof(L, idx)) + 2 * GMP_NUMB_BITS; break;
+	case UI: case SI: case D: prec = 64; break;
+	default: return 0;
+	}
+	return prec < MPFR_PREC_MIN ? MPFR_PREC_MIN : prec;
+}
+
+/* like set, but for internal use on numeric arguments only */
+static int setnum(lua_State *L, int idx, mpfr_t rop, mpfr_rnd_t rnd) {
+	switch (type(L, idx)) {
+	case FR: mpfr_set(rop, tofr(L, idx), rnd); return 1;
+	case Z:  mpfr_set_z(rop, toz(L, idx), rnd); return 1;
+	case F:  mpfr_set_f(rop, tof(L, idx), rnd); return 1;
+	case UI: mpfr_set_ui(rop, toui(L, idx), rnd); return 1;
+	case SI: mpfr_set_si(rop, tosi(L, idx), rnd); return 1;
+	case D:  mpfr_set_d(rop, tod(L, idx), rnd); return 1;
+	default: return 0;
+	}
+}
+
 /* .4 Conversion functions */
 
 static int get_d(lua_State *L) {
@@ -275,7 +404,25 @@ static int get_d(lua_State *L) {
 	lua_pushnumber(L, mpfr_get_d(*self, rnd)); return 1;
 }
 
-/* FIXME get_[us][ij] ? */
+#if LUA_VERSION_NUM < 503
+#define GETI(L, F) do { \
+	mpfr_rnd_t rnd = settoprnd(L, 0, 1); \
+	mpfr_t *self = checkfr(L, 1); \
+	lua_pushnumber(L, (lua_Number)mpfr_##F(*self, rnd)); return 1; \
+} while (0)
+#else
+/* out-of-range values of unsigned types wrap around like string.unpack 'J' */
+#define GETI(L, F) do { \
+	mpfr_rnd_t rnd = settoprnd(L, 0, 1); \
+	mpfr_t *self = checkfr(L, 1); \
+	lua_pushinteger(L, (lua_Integer)mpfr_##F(*self, rnd)); return 1; \
+} while (0)
+#endif
+
+static int get_si(lua_State *L) { GETI(L, get_si); }
+static int get_ui(lua_State *L) { GETI(L, get_ui); }
+static int get_sj(lua_State *L) { GETI(L, get_sj); }
+static int get_uj(lua_State *L) { GETI(L, get_uj); }
 
 static int get_d_2exp(lua_State *L) {
 	mpfr_rnd_t rnd = settoprnd(L, 0, 1);
@@ -388,7 +535,7 @@ static int mul(lua_State *L) {
 	return luaL_error(L, "bad arguments (neither is mpfr)");
 
 	switch (type(L, j)) {
-	case FR: return pushter(L, mpfr_mul(*res, tofr(L, i), tofr(L, j), rnd));
+	case FR: return pushter(L, pmul(tostate(L), *res, tofr(L, i), tofr(L, j), rnd));
 	case Z:  return pushter(L, mpfr_mul_z(*res, tofr(L, i), toz(L, j), rnd));
 	case UI: return pushter(L, mpfr_mul_ui(*res, tofr(L, i), toui(L, j), rnd));
 	case SI: return pushter(L, mpfr_mul_si(*res, tofr(L, i), tosi(L, j), rnd));
@@ -397,12 +544,12 @@ static int mul(lua_State *L) {
 	}
 }
 
-static int div(lua_State *L) {
+static int div_(lua_State *L) {
 	mpfr_rnd_t rnd = settoprnd(L, 0, 3);
 	mpfr_t *res = checkfropt(L, 3);
 
 	switch (twotypes(L, 1, 2)) {
-	case FR:   return pushter(L, mpfr_div(*res, tofr(L, 1), tofr(L, 2), rnd));
+	case FR:   return pushter(L, pdiv(tostate(L), *res, tofr(L, 1), tofr(L, 2), rnd));
 	case FRZ:  return pushter(L, mpfr_div_z(*res, tofr(L, 1), toz(L, 2), rnd));
 	case FRUI: return pushter(L, mpfr_div_ui(*res, tofr(L, 1), toui(L, 2), rnd));
 	case UIFR: return pushter(L, mpfr_ui_div(*res, toui(L, 1), tofr(L, 2), rnd));
@@ -421,10 +568,19 @@ static int rdiv(lua_State *L) {
 	if (lua_gettop(L) < 2) lua_settop(L, 2);
 	lua_pushvalue(L, 1); lua_pushvalue(L, 2);
 	lua_replace(L, 1); lua_replace(L, 2);
-	return div(L); /* FIXME misleading errors */
+	return div_(L); /* FIXME misleading errors */
 }
 
-static int sqrt_(lua_State *L) { UNF_UI(L, sqrt); }
+static int sqrt_(lua_State *L) {
+	mpfr_rnd_t rnd = settoprnd(L, 0, 2);
+	mpfr_t *res = checkfropt(L, 2);
+
+	switch (type(L, 1)) {
+	case FR: return pushter(L, psqrt(tostate(L), *res, tofr(L, 1), rnd));
+	case UI: return pushter(L, mpfr_sqrt_ui(*res, toui(L, 1), rnd));
+	default: return typerror(L, 1, "mpfr or non-negative integer");
+	}
+}
 static int rec_sqrt(lua_State *L) { UNF(L, rec_sqrt); }
 static int cbrt_(lua_State *L) { UNF(L, cbrt); }
 
@@ -443,11 +599,6 @@ static int rootn(lua_State *L) {
 
 static int neg(lua_State *L) { UNF(L, neg); }
 
-static int meth_unm(lua_State *L) {
-	lua_settop(L, 1);
-	return neg(L);
-}
-
 static int abs_(lua_State *L) { UNF(L, abs); }
 
 static int mul_2exp(lua_State *L) {
@@ -532,10 +683,6 @@ static int sgn(lua_State *L) {
 	lua_pushboolean(L, mpfr_ ## P ## _p (*self, *other)); return 1; \
 } while (0)
 
-/* FIXME nan == nan */
-static int lt(lua_State *L) { REL(L, less); }
-static int le(lua_State *L) { REL(L, lessequal); }
-static int eq(lua_State *L) { REL(L, equal); }
 static int ge(lua_State *L) { REL(L, greaterequal); }
 static int gt(lua_State *L) { REL(L, greater); }
 
@@ -607,8 +754,8 @@ static int atanh_(lua_State *L) { UNF(L, atanh); }
 
 static int eint    (lua_State *L) { UNF(L, eint); }
 static int li2     (lua_State *L) { UNF(L, li2); }
-static int gamma_  (lua_State *L) { UNF(L, gamma); }
-static int lngamma (lua_State *L) { UNF(L, lngamma); }
+static int gamma_  (lua_State *L) { MUNF(L, MGAMMA); }
+static int lngamma (lua_State *L) { MUNF(L, MLNGAMMA); }
 
 static int lgamma_(lua_State *L) {
 	mpfr_rnd_t rnd = settoprnd(L, 0, 2);
@@ -618,9 +765,20 @@ static int lgamma_(lua_State *L) {
 	return 3;
 }
 
-static int digamma (lua_State *L) { UNF(L, digamma); }
+static int digamma (lua_State *L) { MUNF(L, MDIGAMMA); }
 static int beta    (lua_State *L) { BIF(L, beta); }
-static int zeta    (lua_State *L) { UNF_UI(L, zeta); }
+
+static int zeta(lua_State *L) {
+	mpfr_rnd_t rnd = settoprnd(L, 0, 2);
+	mpfr_t *res = checkfropt(L, 2);
+
+	switch (type(L, 1)) {
+	case FR: return pushter(L, memo(L, MZETA, *res, 0, tofr(L, 1), rnd));
+	case UI: return pushter(L, memo(L, MZETAUI, *res, toui(L, 1), NULL, rnd));
+	default: return typerror(L, 1, "mpfr or non-negative integer");
+	}
+}
+
 static int erf_    (lua_State *L) { UNF(L, erf); }
 static int erfc_   (lua_State *L) { UNF(L, erfc); }
 
@@ -639,7 +797,7 @@ static int jn_(lua_State *L) {
 	mpfr_t *self = checkfr(L, selfidx), *res = checkfropt(L, 3);
 	luaL_argcheck(L, LONG_MIN <= n && n <= LONG_MAX,
 	              nidx, "index out of range");
-	return pushter(L, mpfr_jn(*res, n, *self, rnd));
+	return pushter(L, memo(L, MJN, *res, n, *self, rnd));
 }
 
 static int y0_(lua_State *L) { UNF(L, y0); }
@@ -657,7 +815,7 @@ static int yn_(lua_State *L) {
 	mpfr_t *self = checkfr(L, selfidx), *res = checkfropt(L, 3);
 	luaL_argcheck(L, LONG_MIN <= n && n <= LONG_MAX,
 	              nidx, "index out of range");
-	return pushter(L, mpfr_yn(*res, n, *self, rnd));
+	return pushter(L, memo(L, MYN, *res, n, *self, rnd));
 }
 
 static int ai (lua_State *L) { UNF(L, ai); }
@@ -800,199 +958,2763 @@ static int prec_round(lua_State *L) {
 	return 1;
 }
 
-static void setfuncs(lua_State *L, int idx, const luaL_Reg *l, int nup) {
-	lua_pushvalue(L, idx);
-	for (; l->name; l++) {
-		int i;
-		for (i = 0; i < nup; i++) lua_pushvalue(L, -(nup + 1));
-		lua_pushcclosure(L, l->func, nup);
-		lua_setfield(L, -2, l->name);
-	}
-	lua_pop(L, 1);
-}
+/* Numerical integration */
 
-static const struct luaL_Reg mod[] = {
-	{"fr", fr},
-	{"set_default_prec", set_default_prec},
-	{"get_default_prec", get_default_prec},
-	{"set_default_rounding_mode", set_default_rounding_mode},
-	{"get_default_rounding_mode", get_default_rounding_mode},
-	{"sqrt", sqrt_},
-	{"log", log_},
-	{"pow", pow_},
-	{"atan2", atan2_},
-	{"beta", beta},
-	{"zeta", zeta},
-	{"jn", jn_},
-	{"yn", yn_},
-	{"agm", agm},
-	{0},
+/* Rules are stored for [-1, 1] as the distances y of the nodes from the
+ * nearer endpoint, so that nodes crowding towards an endpoint stay accurate,
+ * and the weights w, each node standing for the pair of abscissae -1 + y and
+ * 1 - y.  Each tanh-sinh level adds the nodes halfway between those of the
+ * previous ones and has its step folded into the weights, each Gauss-Legendre
+ * level is a complete rule with twice as many nodes as the previous one. */
+
+enum { TANHSINH, GAUSSLEGENDRE };
+
+static const char *const methods[] = {"tanh-sinh", "gauss-legendre", NULL};
+static const int maxlevels[] = {12, 7};
+
+#define NLEVEL 13
+
+struct level {
+	size_t n;
+	mpfr_t *y, *w;
 };
 
-static const struct luaL_Reg met[] = {
-	{"__gc",       meth_gc},
-	{"__add",      add},
-	{"__sub",      sub},
-	{"__mul",      mul},
-	{"__div",      div},
-	/* FIXME __mod with quotient to -inf */
-	{"__pow",      pow_},
-	{"__unm",      meth_unm},
-	{"__concat",   meth_concat},
-	{"__lt",       lt},
-	{"__le",       le},
-	{"__eq",       eq},
-	{"__ge",       ge},
-	{"__gt",       gt},
-	{"__tostring", meth_tostring},
-	/* .1 Initialization functions */
-	{"set_prec",   set_prec},
-	{"get_prec",   get_prec},
-	/* .2 Assignment functions */
-	{"set",        set},
-	/* .4 Conversion functions */
-	{"get_d",      get_d},
-	{"get_d_2exp", get_d_2exp},
-	{"get_str",    get_str},
-	{"fits_ulong",   fits_ulong},
-	{"fits_slong",   fits_slong},
-	{"fits_uint",    fits_uint},
-	{"fits_sint",    fits_sint},
-	{"fits_ushort",  fits_ushort},
-	{"fits_sshort",  fits_sshort},
-	{"fits_uintmax", fits_uintmax},
-	{"fits_intmax",  fits_intmax},
-	/* .5 Arithmetic functions */
-	{"add",        add},
-	{"sub",        sub},
-	{"rsub",       rsub},
-	{"mul",        mul},
-	{"div",        div},
-	{"rdiv",       rdiv},
-	{"sqrt",       sqrt_},
-	{"rsqrt",      rec_sqrt}, /* more common name */
-	{"rec_sqrt",   rec_sqrt},
-	{"cbrt",       cbrt_},
-	{"rootn",      rootn},
-	{"neg",        neg},
-	{"abs",        abs_},
-	{"mul_2exp",   mul_2exp},
-	{"div_2exp",   div_2exp},
-	/* .6 Comparison functions */
-	{"cmp",        cmp},
-	{"nan",        nan_},
-	{"inf",        inf},
-	{"number",     number},
-	{"zero",       zero},
-	{"regular",    regular},
-	{"sgn",        sgn},
-	/* .7 Transcendental functions */
-	{"log",        log_},
-	{"log2",       log2_},
-	{"log10",      log10_},
-	{"log1p",      log1p_},
-	{"exp",        exp_},
-	{"exp2",       exp2_},
-	{"exp10",      exp10_},
-	{"expm1",      expm1_},
-	{"pow",        pow_},
-	{"rpow",       rpow},
-	{"cos",        cos_},
-	{"sin",        sin_},
-	{"tan",        tan_},
-	{"sincos",     sin_cos}, /* more common name */
-	{"sin_cos",    sin_cos},
-	{"sec",        sec},
-	{"csc",        csc},
-	{"cot",        cot},
-	{"acos",       acos_},
-	{"asin",       asin_},
-	{"atan",       atan_},
-	{"atan2",      atan2_},
-	{"cosh",       cosh_},
-	{"sinh",       sinh_},
-	{"tanh",       tanh_},
-	{"sincosh",    sinh_cosh}, /* by analogy with sincos() */
-	{"sinh_cosh",  sinh_cosh},
-	{"sech",       sech},
-	{"csch",       csch},
-	{"coth",       coth},
-	{"acosh",      acosh_},
-	{"asinh",      asinh_},
-	{"atanh",      atanh_},
-	{"eint",       eint},
-	{"li2",        li2},
-	{"gamma",      gamma_},
-	{"tgamma",     gamma_}, /* C99 name */
-	{"lngamma",    lngamma},
-	{"lgamma",     lgamma_},
-	{"digamma",    digamma},
-	{"beta",       beta},
-	{"zeta",       zeta},
-	{"erf",        erf_},
-	{"erfc",       erfc_},
-	{"j0",         j0_},
-	{"j1",         j1_},
-	{"jn",         jn_},
-	{"y0",         y0_},
-	{"y1",         y1_},
-	{"yn",         yn_},
-	{"ai",         ai},
-	{"agm",        agm},
-	/* .9 Formatted output functions */
-	{"format",     format},
-	/* .10 Integer and remainder related functions */
-	{"rint",       rint_},
-	{"ceil",       ceil_},
-	{"floor",      floor_},
-	{"round",      round_},
-	{"roundeven",  roundeven_},
-	{"trunc",      trunc_},
-	{"integer",    integer},
-	/* .11 Rounding-related functions */
-	{"prec_round", prec_round},
-	{0},
+struct rule {
+	struct rule *next;
+	int method, nlevel; mpfr_prec_t prec;
+	struct level level[NLEVEL];
 };
 
-static void loadgmp(lua_State *L) {
-	int frmeta = lua_gettop(L), gmp = frmeta + 1;
+static void freelevel(struct level *lv) {
+	size_t i;
+	for (i = 0; i < lv->n; i++) {
+		mpfr_clear(lv->y[i]); mpfr_clear(lv->w[i]);
+	}
+	free(lv->y); free(lv->w);
+	memset(lv, 0, sizeof *lv);
+}
 
-	lua_getglobal(L, "require");
-	lua_pushstring(L, "gmp");
-	if (lua_pcall(L, 1, 1, 0)) {
-		lua_pop(L, 1); lua_newtable(L);
+static int pushnode(struct level *lv, size_t *cap, mpfr_prec_t prec) {
+	if (lv->n == *cap) {
+		size_t newcap = *cap ? 2 * *cap : 16;
+		mpfr_t *y, *w;
+		if (!(y = realloc(lv->y, newcap * sizeof *y))) return 0;
+		lv->y = y;
+		if (!(w = realloc(lv->w, newcap * sizeof *w))) return 0;
+		lv->w = w; *cap = newcap;
 	}
+	mpfr_init2(lv->y[lv->n], prec); mpfr_init2(lv->w[lv->n], prec);
+	lv->n++; return 1;
+}
 
-	lua_getfield(L, gmp, "z");
-	if (lua_pcall(L, 0, 1, 0) || !lua_isuserdata(L, -1) || !lua_getmetatable(L, -1))
-		lua_pushvalue(L, frmeta);
-	lua_remove(L, -2);
+static int tanhsinh(struct level *lv, int l, mpfr_prec_t prec) {
+	size_t cap = 0; unsigned long k; int ok = 1;
+	mpfr_t pi2, t, sh, ch, u, y, w;
+	mpfr_inits2(prec, pi2, t, sh, ch, u, y, w, (mpfr_ptr)0);
+	mpfr_const_pi(pi2, MPFR_RNDN); mpfr_div_2ui(pi2, pi2, 1, MPFR_RNDN);
+
+	for (k = l ? 1 : 0; ; k += l ? 2 : 1) {
+		mpfr_set_ui_2exp(t, k, -l, MPFR_RNDN);
+		mpfr_sinh_cosh(sh, ch, t, MPFR_RNDN);
+		mpfr_mul(u, sh, pi2, MPFR_RNDN);
+		/* y = 1 - tanh u = 2 / (exp 2u + 1) */
+		mpfr_mul_2ui(y, u, 1, MPFR_RNDN);
+		mpfr_exp(y, y, MPFR_RNDN);
+		mpfr_add_ui(y, y, 1, MPFR_RNDN);
+		mpfr_ui_div(y, 2, y, MPFR_RNDN);
+		/* w = pi/2 cosh t / cosh^2 u, halved for the centre as it is
+		 * counted twice */
+		mpfr_cosh(u, u, MPFR_RNDN);
+		mpfr_sqr(u, u, MPFR_RNDN);
+		mpfr_mul(w, pi2, ch, MPFR_RNDN);
+		mpfr_div(w, w, u, MPFR_RNDN);
+		mpfr_div_2ui(w, w, k ? l : 1, MPFR_RNDN);
+
+		/* stop once the node merges with the endpoint or stops mattering */
+		if (mpfr_get_exp(y) < -prec || mpfr_get_exp(w) < -2 * prec) break;
+		if (!(ok = pushnode(lv, &cap, prec))) break;
+		mpfr_swap(lv->y[lv->n - 1], y);
+		mpfr_swap(lv->w[lv->n - 1], w);
+	}
 
-	lua_getfield(L, gmp, "f");
-	if (lua_pcall(L, 0, 1, 0) || !lua_isuserdata(L, -1) || !lua_getmetatable(L, -1))
-		lua_pushvalue(L, frmeta);
-	lua_remove(L, -2);
+	mpfr_clears(pi2, t, sh, ch, u, y, w, (mpfr_ptr)0);
+	return ok;
+}
 
-	lua_remove(L, gmp);
+/* P_n(x) and P_{n-1}(x) into p and q */
+static void legendre(mpfr_t p, mpfr_t q, mpfr_t x, unsigned long n, mpfr_t t) {
+	unsigned long j;
+	mpfr_set_ui(q, 1, MPFR_RNDN); mpfr_set(p, x, MPFR_RNDN);
+	for (j = 1; j < n; j++) {
+		/* (j + 1) P_{j+1} = (2j + 1) x P_j - j P_{j-1} */
+		mpfr_mul(t, x, p, MPFR_RNDN);
+		mpfr_mul_ui(t, t, 2 * j + 1, MPFR_RNDN);
+		mpfr_mul_ui(q, q, j, MPFR_RNDN);
+		mpfr_sub(t, t, q, MPFR_RNDN);
+		mpfr_div_ui(t, t, j + 1, MPFR_RNDN);
+		mpfr_swap(q, p); mpfr_swap(p, t);
+	}
 }
 
-#ifdef _WIN32
-__declspec(dllexport)
-#endif
-int luaopen_mpfr(lua_State *L) {
-	lua_settop(L, 0);
+static int gausslegendre(struct level *lv, int l, mpfr_prec_t prec) {
+	unsigned long n = 3UL << (l + 1), i, j; size_t cap = 0; int ok = 1;
+	mpfr_t x, p, q, t, d;
+	mpfr_inits2(prec, x, p, q, t, d, (mpfr_ptr)0);
+
+	for (i = 1; i <= n / 2; i++) {
+		double xd = cos(3.14159265358979323846 * (i - 0.25) / (n + 0.5)), dx;
+		mpfr_prec_t cur; int it = 0;
+		if (!(ok = pushnode(lv, &cap, prec))) break;
+
+		/* Newton's method on P_n, first in double precision, where it may
+		 * oscillate in the last bit and is cut off after a few steps */
+		do {
+			double p0 = 1, p1 = xd, p2;
+			for (j = 1; j < n; j++) {
+				p2 = ((2 * j + 1) * xd * p1 - j * p0) / (j + 1);
+				p0 = p1; p1 = p2;
+			}
+			dx = p1 * (xd * xd - 1) / (n * (xd * p1 - p0));
+			xd -= dx;
+		} while (fabs(dx) > 1e-15 && ++it < 16);
+
+		/* then doubling the precision at each step */
+		mpfr_set_prec(x, 64); mpfr_set_d(x, xd, MPFR_RNDN);
+		for (cur = 64; ; cur = 2 * cur < prec ? 2 * cur : prec) {
+			mpfr_prec_round(x, cur, MPFR_RNDN);
+			mpfr_set_prec(p, cur); mpfr_set_prec(q, cur);
+			mpfr_set_prec(t, cur); mpfr_set_prec(d, cur);
+			legendre(p, q, x, n, t);
+			/* dx = P_n (x^2 - 1) / n (x P_n - P_{n-1}) */
+			mpfr_mul(d, x, p, MPFR_RNDN);
+			mpfr_sub(d, d, q, MPFR_RNDN);
+			mpfr_mul_ui(d, d, n, MPFR_RNDN);
+			mpfr_sqr(t, x, MPFR_RNDN);
+			mpfr_sub_ui(t, t, 1, MPFR_RNDN);
+			mpfr_mul(p, p, t, MPFR_RNDN);
+			mpfr_div(p, p, d, MPFR_RNDN);
+			mpfr_sub(x, x, p, MPFR_RNDN);
+			if (cur >= prec) break;
+		}
+
+		/* w = 2 (1 - x^2) / (n (x P_n - P_{n-1}))^2 */
+		legendre(p, q, x, n, t);
+		mpfr_mul(d, x, p, MPFR_RNDN);
+		mpfr_sub(d, d, q, MPFR_RNDN);
+		mpfr_mul_ui(d, d, n, MPFR_RNDN);
+		mpfr_sqr(d, d, MPFR_RNDN);
+		mpfr_sqr(t, x, MPFR_RNDN);
+		mpfr_ui_sub(t, 1, t, MPFR_RNDN);
+		mpfr_mul_2ui(t, t, 1, MPFR_RNDN);
+		mpfr_div(lv->w[lv->n - 1], t, d, MPFR_RNDN);
+		mpfr_ui_sub(lv->y[lv->n - 1], 1, x, MPFR_RNDN);
+	}
 
-	lua_createtable(L, 0, sizeof mod / sizeof mod[0] - 1);
+	mpfr_clears(x, p, q, t, d, (mpfr_ptr)0);
+	return ok;
+}
 
-	lua_createtable(L, 0, sizeof met / sizeof met[0] - 1);
-	lua_pushvalue(L, -1);
-	lua_setfield(L, -2, "__index");
-	lua_pushvalue(L, -1); /* FRMETA */
-	loadgmp(L); /* ZMETA, FMETA */
+static struct level *getlevel(lua_State *L, int method, mpfr_prec_t prec, int l) {
+	struct state *st = tostate(L); struct rule *r;
 
-	setfuncs(L, 1, mod, NUP);
-	setfuncs(L, 2, met, NUP);
+	for (r = st->rules; r; r = r->next)
+		if (r->method == method && r->prec == prec) break;
+	if (!r) {
+		if (!(r = calloc(1, sizeof *r)))
+			luaL_error(L, "not enough memory");
+		r->method = method; r->prec = prec;
+		r->next = st->rules; st->rules = r;
+	}
 
-	lua_settop(L, 1);
-	return 1;
+	while (r->nlevel <= l) {
+		struct level *lv = &r->level[r->nlevel];
+		int ok = method == TANHSINH ? tanhsinh(lv, r->nlevel, prec)
+		                            : gausslegendre(lv, r->nlevel, prec);
+		if (!ok) {
+			freelevel(lv);
+			luaL_error(L, "not enough memory");
+		}
+		r->nlevel++;
+	}
+	return &r->level[l];
+}
+
+static void freerules(struct state *st) {
+	while (st->rules) {
+		struct rule *r = st->rules; int l;
+		st->rules = r->next;
+		for (l = 0; l < r->nlevel; l++) freelevel(&r->level[l]);
+		free(r);
+	}
+}
+
+/* f(x, prec) into res, with the default precision that of x during the
+ * call, so that plain arithmetic in f keeps up with the working precision */
+static void callf(lua_State *L, int f, int x, mpfr_t res) {
+	mpfr_prec_t saved = mpfr_get_default_prec(), prec = mpfr_get_prec(tofr(L, x));
+	mpfr_set_default_prec(prec);
+	lua_pushvalue(L, f); lua_pushvalue(L, x); lua_pushinteger(L, prec);
+	if (lua_pcall(L, 2, 1, 0)) {
+		mpfr_set_default_prec(saved);
+		lua_error(L);
+	}
+	mpfr_set_default_prec(saved);
+	if (!setnum(L, -1, res, MPFR_RNDN))
+		luaL_error(L, "bad result from function (mpfr or number expected, got %s)",
+		           luaL_typename(L, -1));
+	lua_pop(L, 1);
+}
+
+/* sum += w f(x) for x at ix, and nz += |w f(x)| ulp(x) / |d| for x at the
+ * distance d from an endpoint: near a singularity (x - e)^-k with k < 1,
+ * which is what tanh-sinh is for, that bounds how much rounding x to the
+ * working precision changes the term, and it is negligible elsewhere */
+static void addnode(lua_State *L, int ix, mpfr_srcptr w, mpfr_srcptr d,
+                    mpfr_ptr sum, mpfr_ptr nz, mpfr_ptr fx, mpfr_ptr t)
+{
+	mpfr_srcptr x = tofr(L, ix);
+	callf(L, 1, ix, fx);
+	mpfr_fma(sum, w, fx, sum, MPFR_RNDN);
+	if (!mpfr_regular_p(x) || !mpfr_number_p(fx)) return;
+	mpfr_mul(t, w, fx, MPFR_RNDA);
+	mpfr_div(t, t, d, MPFR_RNDA);
+	mpfr_abs(t, t, MPFR_RNDN);
+	mpfr_mul_2si(t, t, mpfr_get_exp(x) - mpfr_get_prec(x), MPFR_RNDU);
+	mpfr_add(nz, nz, t, MPFR_RNDU);
+}
+
+/* log |x| for regular x, without overflow */
+static double logabs(mpfr_srcptr x) {
+	long e; double m = mpfr_get_d_2exp(&e, x, MPFR_RNDN);
+	return log(fabs(m)) + e * log(2.0);
+}
+
+/* tl = max(tl, the integral of |f| from an endpoint to the outermost node,
+ * which tanh-sinh drops), given log d and log |f| at the distances d from
+ * the endpoint of that node (in lg[0]) and of the next one inwards (in lg[1]).
+ * Fitting |f| ~ c d^-k there, it is d |f| / (1 - k), or +inf if k >= 1, as
+ * the integral diverges then. */
+static void tailest(mpfr_ptr tl, double lg[2][2], mpfr_ptr t) {
+	double k = (lg[0][1] - lg[1][1]) / (lg[1][0] - lg[0][0]);
+	if (lg[0][1] == -HUGE_VAL) return; /* f vanishes there */
+	if (!(k < 1 - 1e-9)) {
+		mpfr_set_inf(t, 1);
+	} else {
+		mpfr_set_d(t, lg[0][0] + lg[0][1] - log(1 - k), MPFR_RNDU);
+		mpfr_exp(t, t, MPFR_RNDU);
+	}
+	if (mpfr_greater_p(t, tl)) mpfr_set(tl, t, MPFR_RNDU);
+}
+
+/* shifts log d and log |f| for the node just added into lg, see tailest */
+static void tailnode(double lg[2][2], int *n, mpfr_srcptr d, mpfr_srcptr fx) {
+	lg[1][0] = lg[0][0]; lg[1][1] = lg[0][1];
+	lg[0][0] = logabs(d);
+	lg[0][1] = mpfr_zero_p(fx) ? -HUGE_VAL : logabs(fx);
+	if (mpfr_number_p(fx)) (*n)++; else *n = 0;
+}
+
+static int integrate(lua_State *L) {
+	mpfr_prec_t prec = mpfr_get_default_prec(), wp; mpfr_rnd_t rnd;
+	mpfr_t *a, *b, *r, *x, *fx, *sum, *s, *ds, *d, *nz, *nzs, *t, *tl, *res, *err;
+	int method, l, minlevel = 2, converged = 1, i;
+	double d1 = 0, d2 = 0, est = 0, lg[2][2][2]; mpfr_srcptr ymin = NULL;
+
+	lua_settop(L, 4);
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	if (lua_isnil(L, 4)) {
+		lua_newtable(L); lua_replace(L, 4);
+	}
+	luaL_checktype(L, 4, LUA_TTABLE);
+	lua_getfield(L, 4, "prec");
+	lua_getfield(L, 4, "method");
+	lua_getfield(L, 4, "rnd");
+
+	/* the fields are checked here so that errors name them, not #5 to #7 */
+	if (!lua_isnil(L, 5)) {
+		lua_Number p = lua_tonumber(L, 5);
+		if (!lua_isnumber(L, 5))
+			return luaL_argerror(L, 4, "field 'prec' is not a number");
+		if (p != floor(p) || !(MPFR_PREC_MIN <= p && p <= MPFR_PREC_MAX - 32))
+			return luaL_argerror(L, 4, "field 'prec' out of range");
+		prec = p;
+	}
+	method = TANHSINH;
+	if (!lua_isnil(L, 6)) {
+		if (lua_type(L, 6) != LUA_TSTRING)
+			method = -1;
+		else
+			for (method = 0; methods[method] &&
+			     strcmp(methods[method], lua_tostring(L, 6)); method++) ;
+		if (method < 0 || !methods[method])
+			return luaL_argerror(L, 4, "field 'method' is not a valid method");
+	}
+	if (lua_isnil(L, 7))
+		rnd = checkrnd(L, 7);
+	else if (lua_type(L, 7) != LUA_TSTRING || (i = findrnd(lua_tostring(L, 7))) < 0)
+		return luaL_argerror(L, 4, "field 'rnd' is not a valid rounding mode");
+	else
+		rnd = rnds[i];
+	wp = prec + 32;
+
+	a = newtmp(L, wp); b = newtmp(L, wp); r = newtmp(L, wp);
+	x = newtmp(L, wp) /* 11 */; fx = newtmp(L, wp); sum = newtmp(L, wp);
+	s = newtmp(L, wp); ds = newtmp(L, wp); d = newtmp(L, wp);
+	nz = newtmp(L, 53); nzs = newtmp(L, 53); t = newtmp(L, 53); tl = newtmp(L, 53);
+	luaL_argcheck(L, setnum(L, 2, *a, MPFR_RNDN) && mpfr_number_p(*a),
+	              2, "finite mpfr or number expected");
+	luaL_argcheck(L, setnum(L, 3, *b, MPFR_RNDN) && mpfr_number_p(*b),
+	              3, "finite mpfr or number expected");
+	mpfr_sub(*r, *b, *a, MPFR_RNDN);
+	mpfr_div_2ui(*r, *r, 1, MPFR_RNDN);
+	mpfr_set_zero(*s, 1); mpfr_set_zero(*nzs, 1);
+
+	for (l = 0; l <= maxlevels[method]; l++) {
+		struct level *lv = getlevel(L, method, wp, l);
+		size_t i; int nlg[2] = {0, 0};
+		/* whether this level has the outermost nodes so far, which it goes
+		 * through outwards */
+		int outer = method == TANHSINH && lv->n &&
+		            (!ymin || mpfr_less_p(lv->y[lv->n - 1], ymin));
+
+		mpfr_set_zero(*sum, 1); mpfr_set_zero(*nz, 1);
+		/* nodes that round to an endpoint are dropped, as f may well be
+		 * singular there */
+		for (i = 0; i < lv->n; i++) {
+			mpfr_mul(*d, *r, lv->y[i], MPFR_RNDN);
+			mpfr_add(*x, *a, *d, MPFR_RNDN);
+			if (!mpfr_equal_p(*x, *a)) {
+				addnode(L, 11, lv->w[i], *d, *sum, *nz, *fx, *t);
+				if (outer) tailnode(lg[0], &nlg[0], *d, *fx);
+			}
+			mpfr_sub(*x, *b, *d, MPFR_RNDN);
+			if (!mpfr_equal_p(*x, *b)) {
+				addnode(L, 11, lv->w[i], *d, *sum, *nz, *fx, *t);
+				if (outer) tailnode(lg[1], &nlg[1], *d, *fx);
+			}
+		}
+		mpfr_mul(*sum, *sum, *r, MPFR_RNDN);
+		mpfr_mul(*nz, *nz, *r, MPFR_RNDA); mpfr_abs(*nz, *nz, MPFR_RNDN);
+		if (outer) {
+			ymin = lv->y[lv->n - 1];
+			mpfr_set_zero(*tl, 1);
+			if (nlg[0] >= 2) tailest(*tl, lg[0], *t);
+			if (nlg[1] >= 2) tailest(*tl, lg[1], *t);
+		}
+		if (method == TANHSINH) {
+			mpfr_div_2ui(*fx, *s, 1, MPFR_RNDN);
+			mpfr_add(*sum, *sum, *fx, MPFR_RNDN);
+			mpfr_div_2ui(*nzs, *nzs, 1, MPFR_RNDU);
+			mpfr_add(*nzs, *nzs, *nz, MPFR_RNDU);
+		} else {
+			mpfr_set(*nzs, *nz, MPFR_RNDU);
+		}
+		mpfr_sub(*ds, *sum, *s, MPFR_RNDN);
+		mpfr_swap(*s, *sum);
+		if (!mpfr_number_p(*s)) break;
+		if (l == 0) continue;
+
+		/* the error roughly squares with each level, so estimate it from
+		 * the last two differences in the manner of Bailey's quadts */
+		if (mpfr_zero_p(*ds)) {
+			est = -wp;
+		} else {
+			d2 = d1;
+			d1 = mpfr_get_exp(*ds) - (mpfr_zero_p(*s) ? 0 : mpfr_get_exp(*s));
+			est = d1;
+			if (l > 1 && d1 < d2 && d2 < 0)
+				est = d1 * d1 / d2 > 2 * d1 ? d1 * d1 / d2 : 2 * d1;
+			if (est < -wp) est = -wp;
+		}
+		/* more levels do not help once the rounding errors dominate */
+		if (l >= minlevel && (est < -prec || mpfr_regular_p(*s) && mpfr_regular_p(*nzs) &&
+		    est < mpfr_get_exp(*nzs) - mpfr_get_exp(*s)))
+			break;
+	}
+	/* without reaching either, the extrapolation is unfounded: the error is
+	 * taken to be the last difference, or unknown if that did not shrink by
+	 * a bit at least, as when the integral diverges */
+	if (l > maxlevels[method]) {
+		if (d1 > d2 - 1) converged = 0; else est = d1;
+	}
+
+	res = newtmp(L, prec);
+	err = newtmp(L, 53);
+	if (!mpfr_number_p(*s) || !converged)
+		mpfr_set_inf(*err, 1); /* nothing is known */
+	else
+		mpfr_set_ui_2exp(*err, 1, (mpfr_exp_t)est + (mpfr_regular_p(*s) ? mpfr_get_exp(*s) : 0),
+		                 MPFR_RNDU);
+	if (mpfr_less_p(*err, *nzs)) mpfr_set(*err, *nzs, MPFR_RNDU);
+	if (mpfr_less_p(*err, *tl)) mpfr_set(*err, *tl, MPFR_RNDU);
+	mpfr_set(*res, *s, rnd);
+	return 2;
+}
+
+/* Root finding */
+
+/* x -= (f(x) - y)/df(x) at the precision of x, leaving the step in dx */
+static int newtonstep(lua_State *L, int f, int df, mpfr_srcptr y, int ix,
+                      mpfr_t dx, mpfr_t dfx)
+{
+	mpfr_ptr x = tofr(L, ix); mpfr_prec_t prec = mpfr_get_prec(x);
+	mpfr_set_prec(dx, prec); mpfr_set_prec(dfx, prec);
+	callf(L, f, ix, dx);
+	callf(L, df, ix, dfx);
+	if (y) mpfr_sub(dx, dx, y, MPFR_RNDN);
+	mpfr_div(dx, dx, dfx, MPFR_RNDN);
+	if (!mpfr_number_p(dx)) return 0;
+	mpfr_sub(x, x, dx, MPFR_RNDN);
+	return 1;
+}
+
+#define NEWTONPREC 64   /* iterate to convergence at no more than this */
+#define NEWTONITER 100
+
+/* Newton's iteration for f(x) = y (or 0 if y is 0), from the initial
+ * value at index x0.  Converges at low precision first, then roughly
+ * doubles the precision of the iterate with each step, so that the
+ * final steps dominate the cost. */
+static int solve(lua_State *L, int f, int df, int y, int x0) {
+	mpfr_prec_t prec, wp[64]; mpfr_rnd_t rnd;
+	mpfr_t *x, *dx, *dfx, *res, *err; mpfr_ptr yv = NULL;
+	int n = 0, i, top = x0 + 2;
+
+	lua_settop(L, top);
+	luaL_checktype(L, f, LUA_TFUNCTION);
+	luaL_checktype(L, df, LUA_TFUNCTION);
+	prec = lua_isnil(L, x0 + 1) ? mpfr_get_default_prec() : checkprec(L, x0 + 1);
+	rnd = checkrnd(L, x0 + 2);
+	if (y) {
+		if (isfr(L, y)) {
+			yv = tofr(L, y);
+		} else {
+			mpfr_prec_t yp = exactprec(L, y);
+			luaL_argcheck(L, yp, y, "mpfr or number expected");
+			yv = *newtmp(L, yp);
+			setnum(L, y, yv, MPFR_RNDN); /* exact */
+			lua_replace(L, y);
+		}
+	}
+
+	/* the precisions of the doubling steps, from last to first */
+	wp[n++] = prec + 16;
+	while (wp[n - 1] > NEWTONPREC && n < 64) {
+		wp[n] = wp[n - 1] / 2 + 4; n++;
+	}
+
+	x = newtmp(L, wp[n - 1]) /* top + 1 */; dx = newtmp(L, 53); dfx = newtmp(L, 53);
+	luaL_argcheck(L, setnum(L, x0, *x, MPFR_RNDN), x0, "mpfr or number expected");
+
+	for (i = 0; ; i++) {
+		if (i == NEWTONITER || !newtonstep(L, f, df, yv, top + 1, *dx, *dfx))
+			return luaL_error(L, "no convergence");
+		if (mpfr_zero_p(*dx) || !mpfr_regular_p(*x) ||
+		    mpfr_get_exp(*dx) <= mpfr_get_exp(*x) - wp[n - 1] / 2)
+			break;
+	}
+	for (i = n - 2; i >= 0; i--) {
+		mpfr_prec_round(*x, wp[i], MPFR_RNDN);
+		if (!newtonstep(L, f, df, yv, top + 1, *dx, *dfx))
+			return luaL_error(L, "no convergence");
+	}
+
+	res = newtmp(L, prec); err = newtmp(L, 53);
+	mpfr_set(*res, *x, rnd);
+	mpfr_abs(*err, *dx, MPFR_RNDU);
+	return 2;
+}
+
+static int newton(lua_State *L) {
+	return solve(L, 1, 2, 0, 3);
+}
+
+static int invert(lua_State *L) {
+	return solve(L, 1, 2, 3, 4);
+}
+
+/* Sorting and searching */
+
+/* like mpfr_cmp, but NaNs are equal to each other and greater than anything
+ * else, so that they sort last */
+static int ordcmp(mpfr_srcptr a, mpfr_srcptr b) {
+	if (mpfr_nan_p(a)) return !mpfr_nan_p(b);
+	if (mpfr_nan_p(b)) return -1;
+	return mpfr_cmp(a, b);
+}
+
+static mpfr_t *checkelem(lua_State *L, int idx, lua_Integer i) {
+	mpfr_t *p;
+	lua_rawgeti(L, idx, i);
+	if (!isfr(L, -1))
+		luaL_error(L, "bad element #%d (mpfr expected, got %s)",
+		           (int)i, luaL_typename(L, -1));
+	p = &tofr(L, -1); lua_pop(L, 1); /* still referenced from the table */
+	return p;
+}
+
+struct elem {
+	mpfr_ptr p;
+	lua_Integer i;
+};
+
+/* stable, and NaNs last in both directions */
+static int ascending(const void *a, const void *b) {
+	const struct elem *x = a, *y = b;
+	int c = ordcmp(x->p, y->p);
+	return c ? c : (x->i > y->i) - (x->i < y->i);
+}
+
+static int descending(const void *a, const void *b) {
+	const struct elem *x = a, *y = b;
+	int c = mpfr_nan_p(x->p) || mpfr_nan_p(y->p) ? ordcmp(x->p, y->p)
+	                                              : mpfr_cmp(y->p, x->p);
+	return c ? c : (x->i > y->i) - (x->i < y->i);
+}
+
+static struct elem *sorted(lua_State *L, size_t *np) {
+	size_t n, i; struct elem *e;
+	luaL_checktype(L, 1, LUA_TTABLE);
+	n = lua_rawlen(L, 1);
+	e = lua_newuserdata(L, (n ? n : 1) * sizeof *e);
+	for (i = 0; i < n; i++) {
+		e[i].p = *checkelem(L, 1, i + 1);
+		e[i].i = i + 1;
+	}
+	qsort(e, n, sizeof *e, lua_toboolean(L, 2) ? descending : ascending);
+	*np = n; return e;
+}
+
+static int sort(lua_State *L) {
+	size_t n, i; struct elem *e;
+	lua_settop(L, 2);
+	e = sorted(L, &n);
+	/* permute through a copy, so nothing is unreferenced along the way */
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, e[i].i);
+		lua_rawseti(L, -2, i + 1);
+	}
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, -1, i + 1);
+		lua_rawseti(L, 1, i + 1);
+	}
+	lua_settop(L, 1); return 1;
+}
+
+static int argsort(lua_State *L) {
+	size_t n, i; struct elem *e;
+	lua_settop(L, 2);
+	e = sorted(L, &n);
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		lua_pushinteger(L, e[i].i);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+/* ignores NaNs, returns nothing if there is nothing else */
+static int minmax(lua_State *L) {
+	size_t n, i, imin = 0, imax = 0; mpfr_ptr min = NULL, max = NULL;
+	lua_settop(L, 1);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	n = lua_rawlen(L, 1);
+	for (i = 1; i <= n; i++) {
+		mpfr_ptr p = *checkelem(L, 1, i);
+		if (mpfr_nan_p(p)) continue;
+		if (!min || mpfr_less_p(p, min)) min = p, imin = i;
+		if (!max || mpfr_greater_p(p, max)) max = p, imax = i;
+	}
+	if (!min) return 0;
+	lua_rawgeti(L, 1, imin); lua_rawgeti(L, 1, imax);
+	lua_pushinteger(L, imin); lua_pushinteger(L, imax);
+	return 4;
+}
+
+static int searchsorted(lua_State *L) {
+	static const char *const sides[] = {"left", "right", NULL};
+	size_t lo = 1, hi; int right; mpfr_ptr x;
+	lua_settop(L, 3);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	right = luaL_checkoption(L, 3, sides[0], sides);
+	switch (type(L, 2)) {
+	case FR: x = tofr(L, 2); break;
+	case UI: case SI: case D:
+		x = *newtmp(L, 64); setnum(L, 2, x, MPFR_RNDN); break; /* exact */
+	default: return typerror(L, 2, "mpfr or number");
+	}
+
+	hi = lua_rawlen(L, 1) + 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = ordcmp(*checkelem(L, 1, mid), x);
+		if (c < 0 || right && c == 0) lo = mid + 1; else hi = mid;
+	}
+	lua_pushinteger(L, lo); return 1;
+}
+
+/* Memoization */
+
+struct entry {
+	struct entry *chain, *prev, *next;
+	unsigned long hash;
+	int fn, ter; long n; mpfr_rnd_t rnd;
+	mpfr_t arg, val;
+};
+
+static int memofn(int fn, mpfr_ptr res, long n, mpfr_srcptr x, mpfr_rnd_t rnd) {
+	switch (fn) {
+	case MGAMMA:   return mpfr_gamma(res, x, rnd);
+	case MLNGAMMA: return mpfr_lngamma(res, x, rnd);
+	case MDIGAMMA: return mpfr_digamma(res, x, rnd);
+	case MZETA:    return mpfr_zeta(res, x, rnd);
+	case MZETAUI:  return mpfr_zeta_ui(res, (unsigned long)n, rnd);
+	case MJN:      return mpfr_jn(res, n, x, rnd);
+	case MYN:      return mpfr_yn(res, n, x, rnd);
+	}
+	return 0;
+}
+
+#define MIX(H, V) ((H) = ((H) ^ (unsigned long)(V)) * 16777619UL)
+
+/* depends on the value of x but not on its precision */
+static unsigned long hashkey(int fn, long n, mpfr_srcptr x,
+                             mpfr_prec_t prec, mpfr_rnd_t rnd)
+{
+	unsigned long h = 2166136261UL;
+	MIX(h, fn); MIX(h, n); MIX(h, prec); MIX(h, rnd);
+	if (x) {
+		int kind = mpfr_custom_get_kind(x);
+		MIX(h, kind);
+		if (kind == MPFR_REGULAR_KIND || kind == -MPFR_REGULAR_KIND) {
+			const mp_limb_t *d = mpfr_custom_get_significand(x);
+			size_t i, k = mpfr_custom_get_size(mpfr_get_prec(x)) / sizeof *d;
+			MIX(h, mpfr_custom_get_exp(x));
+			for (i = 0; i < k; i++) /* from the top, skipping padding */
+				if (d[k - 1 - i]) { MIX(h, i); MIX(h, d[k - 1 - i]); }
+		}
+	}
+	return h;
+}
+
+static int samekey(const struct entry *e, int fn, long n, mpfr_srcptr x,
+                   mpfr_prec_t prec, mpfr_rnd_t rnd)
+{
+	if (e->fn != fn || e->n != n || e->rnd != rnd || mpfr_get_prec(e->val) != prec)
+		return 0;
+	if (!x) return 1;
+	if (mpfr_custom_get_kind(e->arg) != mpfr_custom_get_kind(x)) return 0;
+	return !mpfr_regular_p(x) || mpfr_equal_p(e->arg, x);
+}
+
+static void unlink_(struct memo *m, struct entry *e) {
+	struct entry **pp = &m->buckets[e->hash % m->nbucket];
+	while (*pp != e) pp = &(*pp)->chain;
+	*pp = e->chain;
+	if (e->prev) e->prev->next = e->next; else m->first = e->next;
+	if (e->next) e->next->prev = e->prev; else m->last = e->prev;
+	m->count--;
+}
+
+static void link_(struct memo *m, struct entry *e) {
+	struct entry **pp = &m->buckets[e->hash % m->nbucket];
+	e->chain = *pp; *pp = e;
+	e->prev = NULL; e->next = m->first;
+	if (m->first) m->first->prev = e; else m->last = e;
+	m->first = e;
+	m->count++;
+}
+
+static void flushmemo(struct memo *m) {
+	while (m->first) {
+		struct entry *e = m->first;
+		unlink_(m, e);
+		mpfr_clear(e->arg); mpfr_clear(e->val); free(e);
+	}
+	m->hits = m->misses = 0;
+}
+
+static int memo(lua_State *L, int fn, mpfr_ptr res,
+                long n, mpfr_srcptr x, mpfr_rnd_t rnd)
+{
+	struct memo *m = &tostate(L)->memo; struct entry *e;
+	mpfr_prec_t prec = mpfr_get_prec(res); unsigned long h;
+
+	if (!m->capacity)
+		return memofn(fn, res, n, x, rnd);
+
+	h = hashkey(fn, n, x, prec, rnd);
+	for (e = m->buckets[h % m->nbucket]; e; e = e->chain) {
+		if (e->hash != h || !samekey(e, fn, n, x, prec, rnd)) continue;
+		m->hits++;
+		unlink_(m, e); link_(m, e);
+		mpfr_set(res, e->val, rnd); /* exact */
+		return e->ter;
+	}
+	m->misses++;
+
+	if (m->count < m->capacity) {
+		if (!(e = malloc(sizeof *e)))
+			return memofn(fn, res, n, x, rnd);
+		mpfr_init2(e->arg, MPFR_PREC_MIN); mpfr_init2(e->val, prec);
+	} else {
+		e = m->last; unlink_(m, e);
+		mpfr_set_prec(e->val, prec);
+	}
+	/* copy the argument first, it may be the same as the result */
+	if (x) {
+		mpfr_set_prec(e->arg, mpfr_get_prec(x));
+		mpfr_set(e->arg, x, MPFR_RNDN);
+	}
+	e->hash = h; e->fn = fn; e->n = n; e->rnd = rnd;
+	e->ter = memofn(fn, res, n, x, rnd);
+	mpfr_set(e->val, res, MPFR_RNDN);
+	link_(m, e);
+	return e->ter;
+}
+
+static int memoize(lua_State *L) {
+	struct memo *m = &tostate(L)->memo; struct entry **buckets = NULL;
+	size_t nbucket = 0;
+#if LUA_VERSION_NUM < 503
+	lua_Number capacity = luaL_checknumber(L, 1);
+#else
+	lua_Integer capacity = luaL_checkinteger(L, 1);
+#endif
+	luaL_argcheck(L, 0 <= capacity && capacity <= INT_MAX,
+	              1, "capacity out of range");
+	if (capacity) {
+		for (nbucket = 16; nbucket < (size_t)capacity; nbucket *= 2);
+		if (!(buckets = calloc(nbucket, sizeof *buckets)))
+			return luaL_error(L, "not enough memory");
+	}
+
+	flushmemo(m); free(m->buckets);
+	m->buckets = buckets; m->nbucket = nbucket; m->capacity = capacity;
+	return 0;
+}
+
+static int memo_stats(lua_State *L) {
+	struct memo *m = &tostate(L)->memo;
+	lua_pushinteger(L, (lua_Integer)m->hits);
+	lua_pushinteger(L, (lua_Integer)m->misses);
+	lua_pushinteger(L, m->count);
+	return 3;
+}
+
+static int memo_flush(lua_State *L) {
+	flushmemo(&tostate(L)->memo);
+	return 0;
+}
+
+/* Parallel arithmetic */
+
+/* Above the threshold, products are split into exact products of pieces of
+ * the significands, one per thread, and summed with a single rounding by
+ * mpfr_sum, so they stay correctly rounded.  Division and square root use
+ * Newton's iteration for 1/b and 1/sqrt(a) built on these products, with the
+ * working precision roughly doubling at each step, and fall back to MPFR when
+ * the result can't be rounded.  The exponent range is per thread in MPFR, so
+ * the workers copy the caller's; the pieces are exact and raise no flags. */
+
+#define THRESHOLD 1000000 /* bits */
+#define MAXTHREAD 64
+#define GUARD     16
+
+struct part {
+	mpfr_srcptr x, y; mpfr_t p;
+	mpfr_exp_t emin, emax;
+};
+
+static void *mulpart(void *arg) {
+	struct part *t = arg;
+	mpfr_set_emin(t->emin); mpfr_set_emax(t->emax);
+	mpfr_mul(t->p, t->x, t->y, MPFR_RNDN); /* exact */
+	return NULL;
+}
+
+#ifdef LMPFR_THREADS
+#define NTHREAD(st) ((st)->nthread)
+#else
+#define NTHREAD(st) 1
+#endif
+
+/* fn on each of the k elements of the given size at arg, in parallel */
+static void runthreads(void *(*fn)(void *), void *arg, size_t size, int k) {
+	char *p = arg; int i;
+#ifdef LMPFR_THREADS
+	pthread_t thread[MAXTHREAD]; int ok[MAXTHREAD];
+	for (i = 1; i < k; i++)
+		ok[i] = !pthread_create(&thread[i], NULL, fn, p + i * size);
+	if (k > 0) fn(p);
+	for (i = 1; i < k; i++)
+		if (ok[i]) pthread_join(thread[i], NULL); else fn(p + i * size);
+#else
+	for (i = 0; i < k; i++) fn(p + i * size);
+#endif
+}
+
+static int parallel(const struct state *st, mpfr_prec_t prec,
+                    mpfr_srcptr x, mpfr_srcptr y)
+{
+	return NTHREAD(st) > 1 && prec >= st->threshold &&
+	       mpfr_regular_p(x) && mpfr_regular_p(y);
+}
+
+/* x into at most k exact pieces of at most size bits, returns their count */
+static int split(mpfr_t *piece, mpfr_srcptr x, int k, mpfr_prec_t size) {
+	mpfr_t rest; int i;
+	mpfr_init2(rest, mpfr_get_prec(x)); mpfr_set(rest, x, MPFR_RNDN);
+	for (i = 0; i < k && !mpfr_zero_p(rest); i++) {
+		mpfr_prec_t prec = mpfr_min_prec(rest);
+		if (i < k - 1 && prec > size) prec = size;
+		if (prec < MPFR_PREC_MIN) prec = MPFR_PREC_MIN;
+		mpfr_init2(piece[i], prec);
+		mpfr_set(piece[i], rest, MPFR_RNDZ); /* leading bits */
+		mpfr_sub(rest, rest, piece[i], MPFR_RNDN); /* exact */
+	}
+	mpfr_clear(rest);
+	return i;
+}
+
+static int pmul(const struct state *st, mpfr_ptr rop,
+                mpfr_srcptr x, mpfr_srcptr y, mpfr_rnd_t rnd)
+{
+	struct part part[MAXTHREAD]; mpfr_ptr p[MAXTHREAD];
+	mpfr_t xs[MAXTHREAD], ys[MAXTHREAD];
+	mpfr_prec_t px = mpfr_get_prec(x), py = mpfr_get_prec(y), size = 0;
+	mpfr_exp_t e, emin = mpfr_get_emin(), emax = mpfr_get_emax();
+	int i, j, k = 0, m, n, ter;
+
+	if (!parallel(st, px > py ? px : py, x, y))
+		return mpfr_mul(rop, x, y, rnd);
+	/* all partial products must be in range as well */
+	e = mpfr_get_exp(x) + mpfr_get_exp(y);
+	if (e - emin <= px + py || e > emax)
+		return mpfr_mul(rop, x, y, rnd);
+
+	/* an m by n grid of pieces with the longest piece the shortest */
+	for (i = 1, m = 0; i <= st->nthread; i++) {
+		mpfr_prec_t c = px / i, d = py / (st->nthread / i);
+		if (st->nthread % i) continue;
+		if (c < d) c = d;
+		if (!m || c < size) m = i, size = c;
+	}
+	n = st->nthread / m;
+	m = split(xs, x, m, (px + m - 1) / m);
+	n = split(ys, y, n, (py + n - 1) / n);
+	for (i = 0; i < m; i++) for (j = 0; j < n; j++, k++) {
+		part[k].x = xs[i]; part[k].y = ys[j];
+		part[k].emin = emin; part[k].emax = emax;
+		mpfr_init2(part[k].p, mpfr_get_prec(xs[i]) + mpfr_get_prec(ys[j]));
+		p[k] = part[k].p;
+	}
+
+	runthreads(mulpart, part, sizeof *part, k);
+	ter = mpfr_sum(rop, p, k, rnd);
+	for (i = 0; i < k; i++) mpfr_clear(part[i].p);
+	for (i = 0; i < m; i++) mpfr_clear(xs[i]);
+	for (j = 0; j < n; j++) mpfr_clear(ys[j]);
+	return ter;
+}
+
+/* the regular x with exponent e and the sign of neg, sharing its limbs */
+static void view(mpfr_ptr v, mpfr_srcptr x, mpfr_exp_t e, int neg) {
+	mpfr_custom_init_set(v, neg ? -MPFR_REGULAR_KIND : MPFR_REGULAR_KIND, e,
+	                     mpfr_get_prec(x), mpfr_custom_get_significand(x));
+}
+
+/* precisions of Newton's iteration down from that of r, last below the
+ * threshold, returns the index of the last */
+static int steps(const struct state *st, mpfr_prec_t *q, mpfr_prec_t prec) {
+	int n = 0;
+	for (q[0] = prec; q[n] >= st->threshold && q[n] > 8 * GUARD; n++)
+		q[n + 1] = q[n] / 2 + GUARD;
+	return n;
+}
+
+/* 1/b for b in [1/2, 1) to about the precision of r */
+static void precip(const struct state *st, mpfr_ptr r, mpfr_srcptr b) {
+	mpfr_prec_t q[CHAR_BIT * sizeof(mpfr_prec_t)];
+	int n = steps(st, q, mpfr_get_prec(r));
+	mpfr_t bq, t, u;
+
+	mpfr_set_prec(r, q[n]); mpfr_ui_div(r, 1, b, MPFR_RNDN);
+	mpfr_inits2(q[0], bq, t, u, (mpfr_ptr)0);
+	while (n--) { /* r += r (1 - b r) */
+		mpfr_prec_t lo = q[n] - q[n + 1] + GUARD;
+		mpfr_prec_round(r, q[n], MPFR_RNDN); /* exact */
+		mpfr_set_prec(bq, q[n]); mpfr_set(bq, b, MPFR_RNDN);
+		mpfr_set_prec(t, q[n]); pmul(st, t, bq, r, MPFR_RNDN);
+		mpfr_ui_sub(t, 1, t, MPFR_RNDN); /* exact */
+		mpfr_prec_round(t, lo, MPFR_RNDN);
+		mpfr_set_prec(u, lo); pmul(st, u, r, t, MPFR_RNDN);
+		mpfr_add(r, r, u, MPFR_RNDN);
+	}
+	mpfr_clears(bq, t, u, (mpfr_ptr)0);
+}
+
+/* 1/sqrt(a) for a in [1/2, 2) to about the precision of r */
+static void prsqrt(const struct state *st, mpfr_ptr r, mpfr_srcptr a) {
+	mpfr_prec_t q[CHAR_BIT * sizeof(mpfr_prec_t)];
+	int n = steps(st, q, mpfr_get_prec(r));
+	mpfr_t aq, t, u;
+
+	mpfr_set_prec(r, q[n]); mpfr_rec_sqrt(r, a, MPFR_RNDN);
+	mpfr_inits2(q[0], aq, t, u, (mpfr_ptr)0);
+	while (n--) { /* r += r (1 - a r^2)/2 */
+		mpfr_prec_t lo = q[n] - q[n + 1] + GUARD;
+		mpfr_prec_round(r, q[n], MPFR_RNDN); /* exact */
+		mpfr_set_prec(aq, q[n]); mpfr_set(aq, a, MPFR_RNDN);
+		mpfr_set_prec(t, q[n]); pmul(st, t, r, r, MPFR_RNDN);
+		pmul(st, t, aq, t, MPFR_RNDN);
+		mpfr_ui_sub(t, 1, t, MPFR_RNDN); /* exact */
+		mpfr_prec_round(t, lo, MPFR_RNDN);
+		mpfr_set_prec(u, lo); pmul(st, u, r, t, MPFR_RNDN);
+		mpfr_div_2ui(u, u, 1, MPFR_RNDN);
+		mpfr_add(r, r, u, MPFR_RNDN);
+	}
+	mpfr_clears(aq, t, u, (mpfr_ptr)0);
+}
+
+/* the approximation x of the result to rop scaled by 2^e, if it rounds */
+static int pround(mpfr_ptr rop, mpfr_srcptr x, mpfr_exp_t e,
+                  mpfr_rnd_t rnd, int *ter)
+{
+	if (!mpfr_can_round(x, mpfr_get_prec(x) - GUARD, MPFR_RNDN, MPFR_RNDZ,
+	                    mpfr_get_prec(rop) + (rnd == MPFR_RNDN)))
+		return 0;
+	*ter = mpfr_set(rop, x, rnd);
+	mpfr_mul_2si(rop, rop, e, rnd); /* exact */
+	return 1;
+}
+
+static int pdiv(const struct state *st, mpfr_ptr rop,
+                mpfr_srcptr x, mpfr_srcptr y, mpfr_rnd_t rnd)
+{
+	mpfr_prec_t wp = mpfr_get_prec(rop) + 2 * GUARD; mpfr_exp_t e;
+	mpfr_t xv, yv, r; int ter;
+
+	if (!parallel(st, mpfr_get_prec(rop), x, y))
+		return mpfr_div(rop, x, y, rnd);
+	e = mpfr_get_exp(x) - mpfr_get_exp(y); /* x/y in [2^(e-1), 2^(e+1)) */
+	if (e - 1 <= mpfr_get_emin() || e + 2 > mpfr_get_emax())
+		return mpfr_div(rop, x, y, rnd);
+
+	view(xv, x, 0, mpfr_signbit(x) != mpfr_signbit(y)); view(yv, y, 0, 0);
+	mpfr_init2(r, wp); precip(st, r, yv);
+	pmul(st, r, xv, r, MPFR_RNDN);
+	if (!pround(rop, r, e, rnd, &ter))
+		ter = mpfr_div(rop, x, y, rnd);
+	mpfr_clear(r);
+	return ter;
+}
+
+static int psqrt(const struct state *st, mpfr_ptr rop,
+                 mpfr_srcptr x, mpfr_rnd_t rnd)
+{
+	mpfr_prec_t wp = mpfr_get_prec(rop) + 2 * GUARD; mpfr_exp_t e, odd;
+	mpfr_t xv, r; int ter;
+
+	if (!parallel(st, mpfr_get_prec(rop), x, x) || mpfr_signbit(x))
+		return mpfr_sqrt(rop, x, rnd);
+	e = mpfr_get_exp(x); odd = e & 1; /* sqrt x = sqrt(x 2^(odd-e)) 2^(e-odd)/2 */
+
+	view(xv, x, odd, 0);
+	mpfr_init2(r, wp); prsqrt(st, r, xv);
+	pmul(st, r, xv, r, MPFR_RNDN);
+	if (!pround(rop, r, (e - odd) / 2, rnd, &ter))
+		ter = mpfr_sqrt(rop, x, rnd);
+	mpfr_clear(r);
+	return ter;
+}
+
+static int set_threads(lua_State *L) {
+	struct state *st = tostate(L);
+#if LUA_VERSION_NUM < 503
+	lua_Number n = luaL_checknumber(L, 1);
+#else
+	lua_Integer n = luaL_checkinteger(L, 1);
+#endif
+	luaL_argcheck(L, 1 <= n && n <= MAXTHREAD, 1, "thread count out of range");
+	/* MPFR keeps its flags, exponent range and caches in globals otherwise */
+	luaL_argcheck(L, n == 1 || st->tls, 1, "MPFR is not thread-safe");
+	if (!lua_isnoneornil(L, 2)) st->threshold = checkprec(L, 2);
+	st->nthread = n;
+	return 0;
+}
+
+static int get_threads(lua_State *L) {
+	struct state *st = tostate(L);
+	lua_pushinteger(L, st->nthread);
+	lua_pushinteger(L, st->threshold);
+	return 2;
+}
+
+/* Bulk conversion */
+
+/* packed layouts, as in string.pack */
+static const char *const packings[] = {"d", "j", NULL};
+
+/* the number of values in a table or packed string at idx */
+static size_t checksrc(lua_State *L, int idx, int *packed) {
+	size_t n;
+	*packed = lua_type(L, idx) == LUA_TSTRING;
+	if (*packed) {
+		lua_tolstring(L, idx, &n);
+		luaL_argcheck(L, n % 8 == 0, idx, "length not a multiple of 8");
+		n /= 8;
+	} else {
+		luaL_checktype(L, idx, LUA_TTABLE);
+		n = lua_rawlen(L, idx);
+	}
+	luaL_argcheck(L, n <= INT_MAX, idx, "too many values");
+	return n;
+}
+
+static int from_numbers(lua_State *L) {
+	mpfr_prec_t prec; mpfr_rnd_t rnd; int fmt, packed;
+	size_t i, n;
+	lua_settop(L, 4);
+	prec = lua_isnil(L, 2) ? 0 : checkprec(L, 2);
+	rnd = checkrnd(L, 3);
+	fmt = luaL_checkoption(L, 4, "d", packings);
+	n = checksrc(L, 1, &packed);
+
+	lua_createtable(L, (int)n, 0);
+	for (i = 0; i < n; i++) {
+		mpfr_t *p = newfr(L);
+		if (prec) mpfr_set_prec(*p, prec);
+		if (packed) {
+			/* reread, the string cannot move but the pointer is not kept */
+			const char *s = lua_tostring(L, 1) + 8 * i;
+			if (fmt == 0) {
+				double d; memcpy(&d, s, sizeof d);
+				mpfr_set_d(*p, d, rnd);
+			} else {
+				int64_t j; memcpy(&j, s, sizeof j);
+				mpfr_set_sj(*p, j, rnd);
+			}
+		} else {
+			lua_rawgeti(L, 1, (int)i + 1);
+			if (!setnum(L, -1, *p, rnd))
+				return luaL_error(L, "bad element #%d (number expected, got %s)",
+				                  (int)i + 1, luaL_typename(L, -1));
+			lua_pop(L, 1);
+		}
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+	return 1;
+}
+
+static const char *const layouts[] = {"table", "packed", "d", "j", NULL};
+
+static int to_numbers(lua_State *L) {
+	mpfr_rnd_t rnd; int layout; size_t i, n; luaL_Buffer b;
+	lua_settop(L, 3);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	rnd = checkrnd(L, 2);
+	layout = luaL_checkoption(L, 3, "table", layouts);
+	n = lua_rawlen(L, 1);
+	luaL_argcheck(L, n <= INT_MAX, 1, "too many values");
+
+	if (layout == 0) {
+		lua_createtable(L, (int)n, 0);
+		for (i = 0; i < n; i++) {
+			lua_pushnumber(L, mpfr_get_d(*checkelem(L, 1, i + 1), rnd));
+			lua_rawseti(L, -2, (int)i + 1);
+		}
+		return 1;
+	}
+
+	luaL_buffinit(L, &b);
+	for (i = 0; i < n; i++) {
+		mpfr_t *p = checkelem(L, 1, i + 1);
+		if (layout != 3) {
+			double d = mpfr_get_d(*p, rnd);
+			luaL_addlstring(&b, (const char *)&d, sizeof d);
+		} else {
+			int64_t j = mpfr_get_sj(*p, rnd);
+			luaL_addlstring(&b, (const char *)&j, sizeof j);
+		}
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+/* Prefix scans */
+
+/* Every sum or product is accumulated to nearest at a working precision of
+ * prec + ceil(log2 n) + 2 GUARD + 1 bits, counting the roundings on the
+ * way: k of them put a sum off by at most k half-ulps at the largest
+ * exponent seen, and a product by a relative 2k 2^-wp.  Each result is
+ * rounded to prec bits as requested when mpfr_can_round shows that this
+ * gives the rounding of the exact value, which fails only after
+ * cancellation or very close to a rounding boundary.  Then the result is
+ * computed again, a sum by mpfr_sum over all values so far (in time linear
+ * in their number), a product at doubling precisions up to the one where it
+ * is exact, and the scan resumes from it.  So all results are correctly
+ * rounded, whatever the number of threads.
+ *
+ * In parallel, the values are cut into one chunk per thread, the threads
+ * total all chunks but the last, the totals before each chunk are
+ * accumulated, and the threads scan their chunks from those. */
+
+#define UNKNOWN ULONG_MAX /* rounding count after overflow or underflow */
+
+struct scan {
+	mpfr_srcptr *x; mpfr_ptr *y; /* y is NULL to only total the chunk */
+	size_t lo, hi; int prod, some; mpfr_rnd_t rnd;
+	mpfr_t s; /* the total before the chunk if some, then including it */
+	unsigned long k; mpfr_exp_t m; /* roundings of s, largest exponent */
+	mpfr_exp_t emin, emax;
+};
+
+/* counts the rounding of s with the ternary value ter */
+static void rounded(struct scan *c, int ter) {
+	if (!ter || c->k == UNKNOWN) return;
+	if (!mpfr_regular_p(c->s) ||
+	    mpfr_get_exp(c->s) < c->emin + (mpfr_exp_t)mpfr_get_prec(c->s))
+		c->k = UNKNOWN;
+	else if (c->k++ == 0 || mpfr_get_exp(c->s) > c->m)
+		c->m = mpfr_get_exp(c->s);
+}
+
+static void step(struct scan *c, mpfr_srcptr v) {
+	int ter;
+	if (!c->some) ter = mpfr_set(c->s, v, MPFR_RNDN), c->some = 1;
+	else if (c->prod) ter = mpfr_mul(c->s, c->s, v, MPFR_RNDN);
+	else ter = mpfr_add(c->s, c->s, v, MPFR_RNDN);
+	rounded(c, ter);
+}
+
+/* whether s rounds to prec bits as the exact value would */
+static int roundable(const struct scan *c, mpfr_prec_t prec) {
+	mpfr_exp_t err; int b;
+	if (c->k == 0) return 1;
+	if (c->k == UNKNOWN || !mpfr_regular_p(c->s)) return 0;
+	for (b = 0; (c->k - 1) >> b; b++) ; /* ceil(log2 k) */
+	err = (mpfr_exp_t)mpfr_get_prec(c->s) - b -
+	      (c->prod ? 2 : c->m - mpfr_get_exp(c->s));
+	return err > 0 && mpfr_can_round(c->s, err, MPFR_RNDN, MPFR_RNDZ,
+	                                 prec + (c->rnd == MPFR_RNDN));
+}
+
+/* y[i] and s from the values up to x[i] afresh */
+static void rescan(struct scan *c, size_t i) {
+	struct scan t = *c; mpfr_prec_t q, all = MPFR_PREC_MIN; size_t j;
+	if (!c->prod) {
+		mpfr_sum(c->y[i], (mpfr_ptr *)c->x, i + 1, c->rnd);
+		c->k = 0;
+		rounded(c, mpfr_sum(c->s, (mpfr_ptr *)c->x, i + 1, MPFR_RNDN));
+		return;
+	}
+	for (j = 0; j <= i; j++) {
+		mpfr_prec_t p = mpfr_get_prec(c->x[j]);
+		all = all > MPFR_PREC_MAX - p ? MPFR_PREC_MAX : all + p;
+	}
+	q = mpfr_get_prec(c->s);
+	mpfr_init2(t.s, q);
+	do { /* exact at all bits, barring overflow and underflow */
+		q = q > all / 2 ? all : 2 * q;
+		mpfr_set_prec(t.s, q); t.some = 0; t.k = 0;
+		for (j = 0; j <= i; j++) step(&t, c->x[j]);
+	} while (q < all && !roundable(&t, mpfr_get_prec(c->y[i])));
+	mpfr_set(c->y[i], t.s, c->rnd);
+	/* at 2 wp bits or more, t is off by less than a rounding to wp */
+	c->k = t.k == UNKNOWN ? UNKNOWN : t.k != 0;
+	rounded(c, mpfr_set(c->s, t.s, MPFR_RNDN));
+	mpfr_clear(t.s);
+}
+
+static void *scanpart(void *arg) {
+	struct scan *c = arg; size_t i;
+	mpfr_set_emin(c->emin); mpfr_set_emax(c->emax);
+	for (i = c->lo; i < c->hi; i++) {
+		step(c, c->x[i]);
+		if (!c->y) continue;
+		if (roundable(c, mpfr_get_prec(c->y[i])))
+			mpfr_set(c->y[i], c->s, c->rnd);
+		else
+			rescan(c, i);
+	}
+	return NULL;
+}
+
+/* an mpfr value at idx, or a copy of any other value that fits exactly,
+ * kept alive in the table at tmp */
+static mpfr_srcptr exactfr(lua_State *L, int idx, int tmp, int i) {
+	mpfr_t *p; mpfr_prec_t prec;
+	if (idx < 0) idx += lua_gettop(L) + 1; /* newfr pushes */
+	if (isfr(L, idx)) return tofr(L, idx);
+	if (!(prec = exactprec(L, idx))) return NULL;
+	p = newfr(L);
+	mpfr_set_prec(*p, prec);
+	setnum(L, idx, *p, MPFR_RNDN); /* exact */
+	lua_rawseti(L, tmp, i);
+	return *p;
+}
+
+/* y[i] = x[0] + ... + x[i] or x[0] ... x[i] for all i < n */
+static void scanfr(const struct state *st, mpfr_srcptr *x, mpfr_ptr *y,
+                   size_t n, int prod, mpfr_rnd_t rnd)
+{
+	struct scan chunk[MAXTHREAD], acc;
+	mpfr_prec_t wp; size_t m; int k, c;
+
+	if (!n) return;
+	for (wp = mpfr_get_prec(y[0]) + 2 * GUARD + 1, m = 1; m < n; m *= 2) wp++;
+	k = NTHREAD(st);
+	if ((double)n * wp < st->threshold) k = 1;
+	if ((size_t)k > n / 2) k = n / 2 ? (int)(n / 2) : 1;
+	for (c = 0; c < k; c++) {
+		chunk[c].x = x; chunk[c].y = NULL;
+		chunk[c].lo = n * c / k; chunk[c].hi = n * (c + 1) / k;
+		chunk[c].prod = prod; chunk[c].some = 0; chunk[c].rnd = rnd;
+		chunk[c].k = 0; chunk[c].m = 0;
+		chunk[c].emin = mpfr_get_emin(); chunk[c].emax = mpfr_get_emax();
+		mpfr_init2(chunk[c].s, wp);
+	}
+	runthreads(scanpart, chunk, sizeof *chunk, k - 1);
+
+	/* from the total of each chunk to the total before it */
+	acc = chunk[0]; mpfr_init2(acc.s, wp);
+	for (c = 0; c < k; c++) {
+		unsigned long ck = chunk[c].k; mpfr_exp_t cm = chunk[c].m;
+		mpfr_swap(acc.s, chunk[c].s);
+		chunk[c].k = acc.k; chunk[c].m = acc.m;
+		chunk[c].y = y; chunk[c].some = c > 0;
+		if (c == k - 1) break;
+		if (c == 0) {
+			acc.k = ck; acc.m = cm;
+			continue;
+		}
+		if (acc.k == UNKNOWN || ck == UNKNOWN) acc.k = UNKNOWN;
+		else {
+			if (ck && (!acc.k || cm > acc.m)) acc.m = cm;
+			acc.k += ck;
+		}
+		rounded(&acc, prod ? mpfr_mul(acc.s, acc.s, chunk[c].s, MPFR_RNDN)
+		                   : mpfr_add(acc.s, acc.s, chunk[c].s, MPFR_RNDN));
+	}
+	mpfr_clear(acc.s);
+
+	runthreads(scanpart, chunk, sizeof *chunk, k);
+	for (c = 0; c < k; c++) mpfr_clear(chunk[c].s);
+}
+
+static int scan(lua_State *L, int prod) {
+	mpfr_prec_t prec; mpfr_rnd_t rnd;
+	mpfr_srcptr *x; mpfr_ptr *y;
+	int fmt, packed; size_t i, n;
+	lua_settop(L, 4);
+	prec = lua_isnil(L, 2) ? 0 : checkprec(L, 2);
+	rnd = checkrnd(L, 3);
+	fmt = luaL_checkoption(L, 4, "d", packings);
+	n = checksrc(L, 1, &packed);
+
+	lua_createtable(L, (int)n, 0); /* 5, results */
+	lua_createtable(L, packed ? (int)n : 0, 0); /* 6, converted values */
+	x = lua_newuserdata(L, n * sizeof *x + 1);
+	y = lua_newuserdata(L, n * sizeof *y + 1);
+	for (i = 0; i < n; i++) {
+		mpfr_t *p;
+		if (packed) {
+			/* reread, the string cannot move but the pointer is not kept */
+			const char *s = lua_tostring(L, 1) + 8 * i;
+			p = newfr(L); mpfr_set_prec(*p, 64);
+			if (fmt == 0) {
+				double d; memcpy(&d, s, sizeof d);
+				mpfr_set_d(*p, d, MPFR_RNDN); /* exact */
+			} else {
+				int64_t j; memcpy(&j, s, sizeof j);
+				mpfr_set_sj(*p, j, MPFR_RNDN); /* exact */
+			}
+			lua_rawseti(L, 6, (int)i + 1);
+			x[i] = *p;
+		} else {
+			lua_rawgeti(L, 1, (int)i + 1);
+			if (!(x[i] = exactfr(L, -1, 6, (int)i + 1)))
+				return luaL_error(L, "bad element #%d (number expected, got %s)",
+				                  (int)i + 1, luaL_typename(L, -1));
+			lua_pop(L, 1);
+		}
+		p = newfr(L);
+		if (prec) mpfr_set_prec(*p, prec);
+		lua_rawseti(L, 5, (int)i + 1);
+		y[i] = *p;
+	}
+
+	scanfr(tostate(L), x, y, n, prod, rnd);
+	lua_settop(L, 5);
+	return 1;
+}
+
+static int cumsum(lua_State *L) { return scan(L, 0); }
+static int cumprod(lua_State *L) { return scan(L, 1); }
+
+/* Function approximation */
+
+#define AF(F) {#F, mpfr_ ## F}
+static const struct {
+	const char *name;
+	int (*f)(mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);
+} approxfns[] = {
+	AF(sqrt), AF(rec_sqrt), AF(cbrt), AF(log), AF(log2), AF(log10),
+	AF(log1p), AF(exp), AF(exp2), AF(exp10), AF(expm1), AF(cos), AF(sin),
+	AF(tan), AF(sec), AF(csc), AF(cot), AF(acos), AF(asin), AF(atan),
+	AF(cosh), AF(sinh), AF(tanh), AF(sech), AF(csch), AF(coth), AF(acosh),
+	AF(asinh), AF(atanh), AF(eint), AF(li2), AF(gamma), AF(lngamma),
+	AF(digamma), AF(zeta), AF(erf), AF(erfc), AF(j0), AF(j1), AF(y0),
+	AF(y1), AF(ai),
+	{NULL, NULL}
+};
+#undef AF
+
+#define MAXDEPTH 12 /* so at most 4096 pieces */
+
+/* Piecewise Chebyshev interpolant of f on [brk[0], brk[npiece]], with n
+ * coefficients per piece stored at precision ep in c, or f itself on
+ * pieces marked exact; the scratch values only live while building. */
+struct approx {
+	int (*f)(mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);
+	mpfr_prec_t prec, ep, wp;
+	int n;
+	size_t npiece, nexact, cap;
+	mpfr_t *brk, *c; char *exact;
+	mpfr_t err, s[5], xn; /* error estimate, evaluation scratch */
+	mpfr_t *tab, *fx, *cw; /* cos(pi m/4n) for m <= 4n, 2n samples, 2n coefficients */
+	mpfr_t *mid, w[6], b[7]; /* bisection points, building scratch, estimate sums */
+};
+
+static mpfr_t *initv(size_t n, mpfr_prec_t prec) {
+	mpfr_t *v = malloc(n * sizeof *v); size_t i;
+	if (v) for (i = 0; i < n; i++) mpfr_init2(v[i], prec);
+	return v;
+}
+
+static void clearv(mpfr_t *v, size_t n) {
+	size_t i;
+	if (!v) return;
+	for (i = 0; i < n; i++) mpfr_clear(v[i]);
+	free(v);
+}
+
+static void freescratch(struct approx *ap) {
+	size_t n = ap->n;
+	clearv(ap->tab, 4 * n + 1); clearv(ap->fx, 2 * n); clearv(ap->cw, 2 * n);
+	clearv(ap->mid, MAXDEPTH);
+	ap->tab = ap->fx = ap->cw = ap->mid = NULL;
+}
+
+/* b_j = 2t b_{j+1} - b_{j+2} + c_j, res = t b_1 - b_2 + c_0 */
+static void clenshaw(mpfr_ptr res, mpfr_t *c, int n, mpfr_srcptr t,
+                     mpfr_t *s, mpfr_rnd_t rnd)
+{
+	int j;
+	mpfr_set_zero(s[0], 1); mpfr_set_zero(s[1], 1);
+	for (j = n - 1; j >= 1; j--) {
+		mpfr_mul(s[2], t, s[0], MPFR_RNDN);
+		mpfr_mul_2ui(s[2], s[2], 1, MPFR_RNDN);
+		mpfr_sub(s[2], s[2], s[1], MPFR_RNDN);
+		mpfr_add(s[2], s[2], c[j], MPFR_RNDN);
+		mpfr_swap(s[1], s[0]); mpfr_swap(s[0], s[2]);
+	}
+	mpfr_mul(s[2], t, s[0], MPFR_RNDN);
+	mpfr_sub(s[2], s[2], s[1], MPFR_RNDN);
+	mpfr_add(res, s[2], c[0], rnd);
+}
+
+/* Interpolates f at the 2n Chebyshev nodes of [lo, hi] into cw, of which
+ * the first n coefficients are kept, and estimates the error in w[5]; the
+ * result is 0 if the estimate is above 2^-prec-1 relative to the largest
+ * sample, the coefficients are not seen to decay, or f is not finite.
+ *
+ * With c_k those of f and d_k those computed, the kept ones are off from f
+ * by at most sum_{n<=k<2n} |d_k| + 2 sum_{k>=2n} |c_k|.  The second sum is
+ * taken to be at most 2 sum_{3n/2<=k<2n} |d_k|, which holds (with plenty to
+ * spare for aliasing) when the c_k keep decaying at least as the d_k do.
+ * That is an assumption, not a bound, so it is only made when the decay is
+ * seen: the d_k must fall fourfold in n/2 steps or, when those from n on are
+ * all below the rounding error of the fit, 8n^2 2^-wp times the largest
+ * sample, those from 3n/4 on must be too.  To that come the rounding error
+ * of the fit and that of the evaluation, at most 2^-ep (12n^2 B + S + 8D)
+ * with S, B and D the sums of |c_k|, (k+1)|c_k| and k^2|c_k| (for the
+ * Clenshaw recurrence, the storage of c_k and the mapping of x to [-1, 1]).
+ * Last, f is compared with the result at the extrema of T_n, which would
+ * catch a bad fit the estimate misses. */
+static int fit(struct approx *ap, mpfr_srcptr lo, mpfr_srcptr hi) {
+	mpfr_ptr h = ap->w[0], m = ap->w[1], x = ap->w[2], y = ap->w[3],
+	         scale = ap->w[4], est = ap->w[5];
+	mpfr_ptr t1 = ap->b[0], t2 = ap->b[1], rf = ap->b[2], bs = ap->b[3],
+	         bb = ap->b[4], bd = ap->b[5], t0 = ap->b[6];
+	int n = ap->n, j, k; unsigned long nn = (unsigned long)n * n;
+
+	mpfr_sub(h, hi, lo, MPFR_RNDN); mpfr_div_2ui(h, h, 1, MPFR_RNDN);
+	mpfr_add(m, hi, lo, MPFR_RNDN); mpfr_div_2ui(m, m, 1, MPFR_RNDN);
+	mpfr_set_zero(scale, 1);
+	for (k = 0; k < 2 * n; k++) {
+		mpfr_fma(x, h, ap->tab[2 * k + 1], m, MPFR_RNDN);
+		ap->f(ap->fx[k], x, MPFR_RNDN);
+		if (!mpfr_number_p(ap->fx[k])) return 0;
+		if (mpfr_cmpabs(ap->fx[k], scale) > 0) mpfr_abs(scale, ap->fx[k], MPFR_RNDN);
+	}
+	for (j = 0; j < 2 * n; j++) {
+		mpfr_set_zero(ap->cw[j], 1);
+		for (k = 0; k < 2 * n; k++) {
+			long i = (long)j * (2 * k + 1) % (8 * n);
+			if (i > 4 * n) i = 8 * n - i;
+			mpfr_fma(ap->cw[j], ap->fx[k], ap->tab[i], ap->cw[j], MPFR_RNDN);
+		}
+		mpfr_div_ui(ap->cw[j], ap->cw[j], n, MPFR_RNDN);
+	}
+	mpfr_div_2ui(ap->cw[0], ap->cw[0], 1, MPFR_RNDN);
+
+	/* the sums are bounds, so it is enough to round them upwards */
+	mpfr_set_zero(t1, 1); mpfr_set_zero(t2, 1);
+	for (k = n; k < 2 * n; k++) {
+		mpfr_ptr t = k < n + n / 2 ? t1 : t2;
+		mpfr_abs(x, ap->cw[k], MPFR_RNDU);
+		mpfr_add(t, t, x, MPFR_RNDU);
+	}
+	mpfr_set_zero(bs, 1); mpfr_set_zero(bb, 1); mpfr_set_zero(bd, 1);
+	mpfr_set_zero(t0, 1);
+	for (k = 0; k < n; k++) {
+		mpfr_abs(x, ap->cw[k], MPFR_RNDU);
+		mpfr_add(bs, bs, x, MPFR_RNDU);
+		if (k >= n - n / 4) mpfr_add(t0, t0, x, MPFR_RNDU);
+		mpfr_mul_ui(y, x, k + 1, MPFR_RNDU);
+		mpfr_add(bb, bb, y, MPFR_RNDU);
+		mpfr_mul_ui(y, x, (unsigned long)k * k, MPFR_RNDU);
+		mpfr_add(bd, bd, y, MPFR_RNDU);
+	}
+	mpfr_mul_ui(rf, scale, 8 * nn, MPFR_RNDU);
+	mpfr_mul_2si(rf, rf, -ap->wp, MPFR_RNDU);
+
+	mpfr_add(est, t1, t2, MPFR_RNDU);
+	mpfr_div_2ui(t1, t1, 2, MPFR_RNDN); /* exact */
+	if (mpfr_greater_p(est, rf) ? mpfr_greater_p(t2, t1) : mpfr_greater_p(t0, rf))
+		return 0;
+	mpfr_mul_2ui(t2, t2, 1, MPFR_RNDU);
+	mpfr_add(est, est, t2, MPFR_RNDU);
+	mpfr_add(est, est, rf, MPFR_RNDU);
+	mpfr_mul_ui(bb, bb, 12 * nn, MPFR_RNDU);
+	mpfr_mul_2ui(bd, bd, 3, MPFR_RNDU);
+	mpfr_add(bb, bb, bd, MPFR_RNDU);
+	mpfr_add(bb, bb, bs, MPFR_RNDU);
+	mpfr_mul_2si(bb, bb, -ap->ep, MPFR_RNDU);
+	mpfr_add(est, est, bb, MPFR_RNDU);
+
+	for (k = 0; k <= n; k++) {
+		mpfr_fma(x, h, ap->tab[4 * k], m, MPFR_RNDN);
+		ap->f(y, x, MPFR_RNDN);
+		if (!mpfr_number_p(y)) return 0;
+		clenshaw(x, ap->cw, n, ap->tab[4 * k], ap->s, MPFR_RNDN);
+		mpfr_sub(x, x, y, MPFR_RNDU); mpfr_abs(x, x, MPFR_RNDU);
+		if (mpfr_cmp(x, est) > 0) mpfr_set(est, x, MPFR_RNDU);
+	}
+
+	mpfr_mul_2si(scale, scale, -ap->prec - 1, MPFR_RNDN);
+	return mpfr_cmp(est, scale) <= 0;
+}
+
+static void addpiece(lua_State *L, struct approx *ap, mpfr_srcptr hi, int exact) {
+	size_t k = ap->npiece; int j, n = ap->n;
+
+	if (k == ap->cap) {
+		size_t cap = ap->cap ? 2 * ap->cap : 8; mpfr_t *p; char *e;
+		if (!(p = realloc(ap->brk, (cap + 1) * sizeof *p)))
+			luaL_error(L, "not enough memory");
+		ap->brk = p;
+		if (!(p = realloc(ap->c, cap * n * sizeof *p)))
+			luaL_error(L, "not enough memory");
+		ap->c = p;
+		if (!(e = realloc(ap->exact, cap)))
+			luaL_error(L, "not enough memory");
+		ap->exact = e;
+		ap->cap = cap;
+	}
+
+	mpfr_init2(ap->brk[k + 1], ap->wp);
+	mpfr_set(ap->brk[k + 1], hi, MPFR_RNDN);
+	for (j = 0; j < n; j++) {
+		mpfr_ptr c = ap->c[k * n + j];
+		mpfr_init2(c, ap->ep);
+		if (exact) mpfr_set_zero(c, 1); else mpfr_set(c, ap->cw[j], MPFR_RNDN);
+	}
+	ap->exact[k] = exact; ap->npiece++;
+	if (exact) {
+		ap->nexact++;
+	} else if (mpfr_cmp(ap->w[5], ap->err) > 0) {
+		mpfr_set(ap->err, ap->w[5], MPFR_RNDU);
+	}
+}
+
+static void bisect(lua_State *L, struct approx *ap,
+                   mpfr_srcptr lo, mpfr_srcptr hi, int depth)
+{
+	int ok = fit(ap, lo, hi);
+	if (ok || depth == MAXDEPTH) {
+		addpiece(L, ap, hi, !ok);
+		return;
+	}
+	mpfr_add(ap->mid[depth], lo, hi, MPFR_RNDN);
+	mpfr_div_2ui(ap->mid[depth], ap->mid[depth], 1, MPFR_RNDN);
+	bisect(L, ap, lo, ap->mid[depth], depth + 1);
+	bisect(L, ap, ap->mid[depth], hi, depth + 1);
+}
+
+static void approxeval(struct approx *ap, mpfr_ptr res, mpfr_srcptr x,
+                       mpfr_rnd_t rnd);
+
+/* Whether the interpolant is faster than f itself, which at high precision
+ * and for cheap functions it need not be: both are timed at prec on up to 16
+ * pieces, at a point 0.618 of the way so that it is no special case of f,
+ * repeated until f takes 2 ms (the interpolant stops once it takes longer). */
+static int pays(struct approx *ap) {
+	mpfr_t x[16], y; size_t k, n = 0; long i, reps; clock_t t0, tf, ta;
+
+	for (k = 0; k < ap->npiece && n < 16; k++) {
+		if (ap->exact[k]) continue;
+		mpfr_init2(x[n], ap->prec);
+		mpfr_sub(x[n], ap->brk[k + 1], ap->brk[k], MPFR_RNDN);
+		mpfr_mul_d(x[n], x[n], 0.6180339887498949, MPFR_RNDN);
+		mpfr_add(x[n], x[n], ap->brk[k], MPFR_RNDN);
+		n++;
+	}
+	if (!n) return 1;
+	mpfr_init2(y, ap->prec);
+	for (reps = 1; ; reps *= 2) {
+		t0 = clock();
+		for (i = 0; i < reps; i++)
+			for (k = 0; k < n; k++) ap->f(y, x[k], MPFR_RNDN);
+		tf = clock() - t0;
+		if (tf >= CLOCKS_PER_SEC / 500 || reps >= 1 << 20) break;
+	}
+	t0 = clock();
+	for (i = 0, ta = 0; i < reps && ta < tf; i++) {
+		for (k = 0; k < n; k++) approxeval(ap, y, x[k], MPFR_RNDN);
+		ta = clock() - t0;
+	}
+	mpfr_clear(y);
+	for (k = 0; k < n; k++) mpfr_clear(x[k]);
+	return ta < tf;
+}
+
+static int approximate(lua_State *L) {
+	mpfr_prec_t prec; struct approx *ap; mpfr_t *a, *b;
+	int i, fn;
+
+	lua_settop(L, 4);
+	luaL_checkstring(L, 1);
+	for (fn = 0; approxfns[fn].name; fn++)
+		if (!strcmp(approxfns[fn].name, lua_tostring(L, 1))) break;
+	if (!approxfns[fn].name)
+		return luaL_argerror(L, 1, lua_pushfstring(L,
+		                     "unsupported function '%s'", lua_tostring(L, 1)));
+	prec = lua_isnil(L, 4) ? mpfr_get_default_prec() : checkprec(L, 4);
+
+	ap = lua_newuserdata(L, sizeof *ap); /* 5 */
+	memset(ap, 0, sizeof *ap);
+	ap->f = approxfns[fn].f;
+	ap->n = prec < 992 ? 8 + prec / 4 : 256;
+	for (i = 0; 1 << i < ap->n; i++) ;
+	/* enough for the evaluation error in fit to stay well below 2^-prec */
+	ap->prec = prec; ap->ep = prec + 24 + 2 * i; ap->wp = ap->ep + 16;
+	mpfr_init2(ap->err, 53); mpfr_set_zero(ap->err, 1);
+	mpfr_init2(ap->xn, 64);
+	for (i = 0; i < 5; i++) mpfr_init2(ap->s[i], ap->wp);
+	for (i = 0; i < 6; i++) mpfr_init2(ap->w[i], ap->wp);
+	for (i = 0; i < 7; i++) mpfr_init2(ap->b[i], 64);
+	lua_pushvalue(L, lua_upvalueindex(APMETA));
+	lua_setmetatable(L, 5); /* everything from here on is freed by __gc */
+
+	a = newtmp(L, ap->wp); b = newtmp(L, ap->wp);
+	luaL_argcheck(L, setnum(L, 2, *a, MPFR_RNDN) && mpfr_number_p(*a),
+	              2, "finite mpfr or number expected");
+	luaL_argcheck(L, setnum(L, 3, *b, MPFR_RNDN) && mpfr_number_p(*b),
+	              3, "finite mpfr or number expected");
+	luaL_argcheck(L, mpfr_less_p(*a, *b), 3, "empty interval");
+
+	if (!(ap->tab = initv(4 * ap->n + 1, ap->wp)) ||
+	    !(ap->fx = initv(2 * ap->n, ap->wp)) || !(ap->cw = initv(2 * ap->n, ap->wp)) ||
+	    !(ap->mid = initv(MAXDEPTH, ap->wp)) ||
+	    !(ap->brk = initv(1, ap->wp)))
+		return luaL_error(L, "not enough memory");
+	for (i = 0; i <= 4 * ap->n; i++) {
+		mpfr_const_pi(ap->tab[i], MPFR_RNDN);
+		mpfr_mul_ui(ap->tab[i], ap->tab[i], i, MPFR_RNDN);
+		mpfr_div_ui(ap->tab[i], ap->tab[i], 4 * ap->n, MPFR_RNDN);
+		mpfr_cos(ap->tab[i], ap->tab[i], MPFR_RNDN);
+	}
+
+	mpfr_set(ap->brk[0], *a, MPFR_RNDN);
+	bisect(L, ap, *a, *b, 0);
+	freescratch(ap);
+	for (i = 0; i < 5; i++) mpfr_set_prec(ap->s[i], ap->ep);
+	if (!pays(ap)) { /* then every piece falls back */
+		memset(ap->exact, 1, ap->npiece);
+		ap->nexact = ap->npiece;
+		mpfr_set_zero(ap->err, 1);
+	}
+
+	lua_settop(L, 5);
+	return 1;
+}
+
+static struct approx *checkap(lua_State *L, int idx) {
+	struct approx *ap = lua_touserdata(L, idx);
+	if (!ap || !lua_getmetatable(L, idx) ||
+	    !lua_rawequal(L, -1, lua_upvalueindex(APMETA)))
+		typerror(L, idx, "mpfr approximation");
+	lua_pop(L, 1);
+	return ap;
+}
+
+/* f(x) or its approximation, x is kept at the caller's precision */
+static void approxeval(struct approx *ap, mpfr_ptr res, mpfr_srcptr x,
+                       mpfr_rnd_t rnd)
+{
+	size_t lo = 0, hi = ap->npiece, k;
+	mpfr_t *s = ap->s;
+
+	if (!mpfr_number_p(x) || mpfr_less_p(x, ap->brk[0]) ||
+	    mpfr_greater_p(x, ap->brk[hi])) {
+		ap->f(res, x, rnd);
+		return;
+	}
+	while (hi - lo > 1) { /* brk[lo] <= x <= brk[hi] */
+		size_t mid = lo + (hi - lo) / 2;
+		if (mpfr_lessequal_p(x, ap->brk[mid])) hi = mid; else lo = mid;
+	}
+	k = lo;
+	if (ap->exact[k]) {
+		ap->f(res, x, rnd);
+		return;
+	}
+	mpfr_sub(s[3], x, ap->brk[k], MPFR_RNDN);
+	mpfr_sub(s[4], ap->brk[k + 1], ap->brk[k], MPFR_RNDN);
+	mpfr_div(s[3], s[3], s[4], MPFR_RNDN);
+	mpfr_mul_2ui(s[3], s[3], 1, MPFR_RNDN);
+	mpfr_sub_ui(s[3], s[3], 1, MPFR_RNDN);
+	clenshaw(res, ap->c + k * ap->n, ap->n, s[3], s, rnd);
+}
+
+/* the argument at idx, copied exactly into xn unless it is an mpfr value */
+static mpfr_srcptr aparg(lua_State *L, struct approx *ap, int idx) {
+	mpfr_prec_t prec;
+	if (isfr(L, idx)) return tofr(L, idx);
+	if (!(prec = exactprec(L, idx))) return NULL;
+	if (prec > mpfr_get_prec(ap->xn)) mpfr_set_prec(ap->xn, prec);
+	setnum(L, idx, ap->xn, MPFR_RNDN); /* exact */
+	return ap->xn;
+}
+
+static int ap_eval(lua_State *L) {
+	mpfr_rnd_t rnd = settoprnd(L, 1, 3);
+	struct approx *ap = checkap(L, 1);
+	mpfr_srcptr x; mpfr_t *res;
+	if (!(x = aparg(L, ap, 2)))
+		return typerror(L, 2, "mpfr or number");
+	if (lua_isnil(L, 3)) {
+		res = newtmp(L, ap->prec); lua_replace(L, 3);
+	} else {
+		res = checkfr(L, 3);
+	}
+	approxeval(ap, *res, x, rnd);
+	return 1;
+}
+
+static int ap_evalv(lua_State *L) {
+	mpfr_rnd_t rnd = settoprnd(L, 1, 3);
+	struct approx *ap = checkap(L, 1);
+	size_t i, n;
+	luaL_checktype(L, 2, LUA_TTABLE);
+	if (lua_isnil(L, 3)) {
+		lua_newtable(L); lua_replace(L, 3);
+	}
+	luaL_checktype(L, 3, LUA_TTABLE);
+	n = lua_rawlen(L, 2);
+	luaL_argcheck(L, n <= INT_MAX, 2, "too many values");
+
+	for (i = 1; i <= n; i++) {
+		mpfr_srcptr x; mpfr_t *res;
+		lua_rawgeti(L, 2, (int)i);
+		if (!(x = aparg(L, ap, lua_gettop(L))))
+			return luaL_error(L, "bad element #%d (mpfr or number expected, got %s)",
+			                  (int)i, luaL_typename(L, -1));
+		lua_rawgeti(L, 3, (int)i);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			res = newtmp(L, ap->prec);
+			lua_pushvalue(L, -1); lua_rawseti(L, 3, (int)i);
+		} else if (isfr(L, -1)) {
+			res = &tofr(L, -1);
+		} else {
+			return luaL_error(L, "bad result #%d (mpfr or nil expected, got %s)",
+			                  (int)i, luaL_typename(L, -1));
+		}
+		approxeval(ap, *res, x, rnd);
+		lua_pop(L, 2);
+	}
+	lua_settop(L, 3);
+	return 1;
+}
+
+static int ap_estimate(lua_State *L) {
+	struct approx *ap = checkap(L, 1);
+	mpfr_t *err = newtmp(L, 53);
+	mpfr_set(*err, ap->err, MPFR_RNDU);
+#if LUA_VERSION_NUM < 503
+	lua_pushnumber(L, ap->nexact);
+	lua_pushnumber(L, ap->npiece);
+#else
+	lua_pushinteger(L, ap->nexact);
+	lua_pushinteger(L, ap->npiece);
+#endif
+	return 3;
+}
+
+static int ap_gc(lua_State *L) {
+	struct approx *ap = lua_touserdata(L, 1); int i;
+	freescratch(ap);
+	clearv(ap->brk, ap->brk ? ap->npiece + 1 : 0);
+	clearv(ap->c, ap->npiece * ap->n);
+	free(ap->exact);
+	mpfr_clear(ap->err); mpfr_clear(ap->xn);
+	for (i = 0; i < 5; i++) mpfr_clear(ap->s[i]);
+	for (i = 0; i < 6; i++) mpfr_clear(ap->w[i]);
+	for (i = 0; i < 7; i++) mpfr_clear(ap->b[i]);
+	return 0;
+}
+
+static const struct luaL_Reg apmet[] = {
+	{"__call", ap_eval},
+	{"__gc", ap_gc},
+	{"eval", ap_eval},
+	{"evalv", ap_evalv},
+	{"estimate", ap_estimate},
+	{NULL, NULL}
+};
+
+/* Complex numbers */
+
+struct cx { mpfr_t re, im; };
+
+#define tocx(L, I) ((struct cx *)lua_touserdata((L), (I)))
+
+static int iscx(lua_State *L, int idx) {
+	int ret;
+	if (lua_type(L, idx) != LUA_TUSERDATA || !lua_getmetatable(L, idx))
+		return 0;
+	ret = lua_rawequal(L, -1, lua_upvalueindex(CXMETA));
+	lua_pop(L, 1); return ret;
+}
+
+static struct cx *checkcx(lua_State *L, int idx) {
+	if (!iscx(L, idx))
+		typerror(L, idx, "complex");
+	return tocx(L, idx);
+}
+
+static struct cx *newcx(lua_State *L, mpfr_prec_t prec) {
+	struct cx *z = newudata(L, sizeof *z);
+	mpfr_init2(z->re, prec); mpfr_set_zero(z->re, 1);
+	mpfr_init2(z->im, prec); mpfr_set_zero(z->im, 1);
+	lua_pushvalue(L, lua_upvalueindex(CXMETA));
+	lua_setmetatable(L, -2);
+	return z;
+}
+
+static struct cx *checkcxopt(lua_State *L, int idx) {
+	struct context *ctx = toctx(L); struct cx *z;
+	if (!lua_isnil(L, idx))
+		return checkcx(L, idx);
+	z = newcx(L, ctx ? ctx->prec : mpfr_get_default_prec());
+	lua_replace(L, idx);
+	return z;
+}
+
+/* a complex argument, or a real one converted exactly */
+static struct cx *checkcxarg(lua_State *L, int idx) {
+	struct cx *z;
+	if (iscx(L, idx)) return tocx(L, idx);
+	switch (type(L, idx)) {
+	case FR:
+		z = newcx(L, mpfr_get_prec(tofr(L, idx)));
+		mpfr_set(z->re, tofr(L, idx), MPFR_RNDN);
+		break;
+	case UI: case SI: case D:
+		z = newcx(L, 64);
+		setnum(L, idx, z->re, MPFR_RNDN);
+		break;
+	default:
+		typerror(L, idx, "complex, mpfr, or number");
+		return NULL;
+	}
+	mpfr_set_prec(z->im, MPFR_PREC_MIN); mpfr_set_zero(z->im, 1);
+	lua_replace(L, idx);
+	return z;
+}
+
+/* the result is at the top, followed by the ternary values of both parts */
+#define pushcxter(L, T) \
+	(lua_pushinteger((L), (T)[0]), lua_pushinteger((L), (T)[1]), 3)
+
+static int setpart(lua_State *L, int idx, mpfr_ptr p, mpfr_rnd_t rnd) {
+	switch (type(L, idx)) {
+	case FR:  return mpfr_set(p, tofr(L, idx), rnd);
+	case Z:   return mpfr_set_z(p, toz(L, idx), rnd);
+	case F:   return mpfr_set_f(p, tof(L, idx), rnd);
+	case UI:  return mpfr_set_ui(p, toui(L, idx), rnd);
+	case SI:  return mpfr_set_si(p, tosi(L, idx), rnd);
+	case D:   return mpfr_set_d(p, tod(L, idx), rnd);
+	case NIL: mpfr_set_zero(p, 1); return 0;
+	default:  return typerror(L, idx, "mpfr, mpf, mpz, or number");
+	}
+}
+
+static int cx_set(lua_State *L) {
+	mpfr_rnd_t rnd = settoprnd(L, 1, 3);
+	struct cx *z = checkcx(L, 1); int ter[2];
+
+	if (iscx(L, 2)) {
+		struct cx *w = tocx(L, 2);
+		luaL_argcheck(L, lua_isnil(L, 3), 3, "imaginary part of complex");
+		ter[0] = mpfr_set(z->re, w->re, rnd);
+		ter[1] = mpfr_set(z->im, w->im, rnd);
+	} else {
+		ter[0] = setpart(L, 2, z->re, rnd);
+		ter[1] = setpart(L, 3, z->im, rnd);
+	}
+	lua_settop(L, 1);
+	return pushcxter(L, ter);
+}
+
+static int complex_(lua_State *L) {
+	struct context *ctx = toctx(L);
+	/* no padding, so that cx_set finds a rounding mode in place of im */
+	newcx(L, ctx ? ctx->prec : mpfr_get_default_prec());
+	lua_insert(L, 1);
+	return cx_set(L);
+}
+
+static int cx_set_prec(lua_State *L) {
+	struct cx *z; mpfr_prec_t prec; lua_settop(L, 2);
+	z = checkcx(L, 1); prec = checkprec(L, 2);
+	mpfr_set_prec(z->re, prec); mpfr_set_prec(z->im, prec);
+	return 0;
+}
+
+static int cx_get_prec(lua_State *L) {
+	struct cx *z; lua_settop(L, 1);
+	z = checkcx(L, 1);
+	lua_pushinteger(L, mpfr_get_prec(z->re)); return 1;
+}
+
+#define CXPART(L, E) do { \
+	mpfr_rnd_t rnd = settoprnd(L, 0, 2); \
+	struct cx *z = checkcx(L, 1); mpfr_t *res = checkfropt(L, 2); \
+	return pushter(L, E); \
+} while (0)
+
+static int cx_re(lua_State *L)   { CXPART(L, mpfr_set(*res, z->re, rnd)); }
+static int cx_im(lua_State *L)   { CXPART(L, mpfr_set(*res, z->im, rnd)); }
+static int cx_abs(lua_State *L)  { CXPART(L, mpfr_hypot(*res, z->re, z->im, rnd)); }
+static int cx_arg(lua_State *L)  { CXPART(L, mpfr_atan2(*res, z->im, z->re, rnd)); }
+static int cx_norm(lua_State *L) {
+	CXPART(L, mpfr_fmma(*res, z->re, z->re, z->im, z->im, rnd));
+}
+
+/* Kernels with a single rounding per part */
+
+typedef void (*cxfn)(struct cx *res, struct cx *x, struct cx *y,
+                     mpfr_rnd_t rnd, int ter[2]);
+
+static void cxadd(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_rnd_t rnd, int ter[2])
+{
+	ter[0] = mpfr_add(res->re, x->re, y->re, rnd);
+	ter[1] = mpfr_add(res->im, x->im, y->im, rnd);
+}
+
+static void cxsub(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_rnd_t rnd, int ter[2])
+{
+	ter[0] = mpfr_sub(res->re, x->re, y->re, rnd);
+	ter[1] = mpfr_sub(res->im, x->im, y->im, rnd);
+}
+
+static void cxmul(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_rnd_t rnd, int ter[2])
+{
+	mpfr_t t;
+	if (res != x && res != y) {
+		ter[0] = mpfr_fmms(res->re, x->re, y->re, x->im, y->im, rnd);
+		ter[1] = mpfr_fmma(res->im, x->re, y->im, x->im, y->re, rnd);
+		return;
+	}
+	mpfr_init2(t, mpfr_get_prec(res->re));
+	ter[0] = mpfr_fmms(t, x->re, y->re, x->im, y->im, rnd);
+	ter[1] = mpfr_fmma(res->im, x->re, y->im, x->im, y->re, rnd);
+	mpfr_swap(res->re, t); mpfr_clear(t);
+}
+
+static void cxneg(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_rnd_t rnd, int ter[2])
+{
+	(void)y;
+	ter[0] = mpfr_neg(res->re, x->re, rnd);
+	ter[1] = mpfr_neg(res->im, x->im, rnd);
+}
+
+static void cxconj(struct cx *res, struct cx *x, struct cx *y,
+                   mpfr_rnd_t rnd, int ter[2])
+{
+	(void)y;
+	ter[0] = mpfr_set(res->re, x->re, rnd);
+	ter[1] = mpfr_neg(res->im, x->im, rnd);
+}
+
+static void cxsqr(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_rnd_t rnd, int ter[2])
+{
+	(void)y; cxmul(res, x, x, rnd, ter);
+}
+
+/* Kernels approximating both parts at the working precision of res, with
+ * the error of each less than 2^(EXP - err), or exact if err is EXACT
+ * (see mpfr_can_round).  Four scratch values of the same precision are
+ * passed in t. */
+
+#define EXACT LONG_MAX
+
+typedef void (*cxapprox)(struct cx *res, struct cx *x, struct cx *y,
+                         mpfr_t *t, long err[2]);
+
+/* error of the product of two values with ternaries tf and tg (or, for
+ * mpfr_sin_cos and mpfr_sinh_cosh, return values masked accordingly),
+ * rounded with ternary t: three roundings of at most 2^-wp relative each */
+static long errmul(mpfr_srcptr f, int tf, mpfr_srcptr g, int tg, int t) {
+	if (!tf && mpfr_zero_p(f) || !tg && mpfr_zero_p(g) || !tf && !tg && !t)
+		return EXACT;
+	return mpfr_get_prec(f) - 2;
+}
+
+static void cxdiv(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_t *t, long err[2])
+{
+	int tn = mpfr_fmma(t[0], y->re, y->re, y->im, y->im, MPFR_RNDN),
+	    tr = mpfr_fmma(t[1], x->re, y->re, x->im, y->im, MPFR_RNDN),
+	    ti = mpfr_fmms(t[2], x->im, y->re, x->re, y->im, MPFR_RNDN);
+	err[0] = errmul(t[1], tr, t[0], tn, mpfr_div(res->re, t[1], t[0], MPFR_RNDN));
+	err[1] = errmul(t[2], ti, t[0], tn, mpfr_div(res->im, t[2], t[0], MPFR_RNDN));
+}
+
+/* e^a (cos b + i sin b) */
+static void cxexp(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_t *t, long err[2])
+{
+	int te = mpfr_exp(t[0], x->re, MPFR_RNDN),
+	    ts = mpfr_sin_cos(t[1], t[2], x->im, MPFR_RNDN);
+	(void)y;
+	err[0] = errmul(t[0], te, t[2], ts >> 2, mpfr_mul(res->re, t[0], t[2], MPFR_RNDN));
+	err[1] = errmul(t[0], te, t[1], ts & 3, mpfr_mul(res->im, t[0], t[1], MPFR_RNDN));
+}
+
+/* log |z| + i arg z */
+static void cxlog(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_t *t, long err[2])
+{
+	mpfr_prec_t wp = mpfr_get_prec(res->re);
+	int th = mpfr_hypot(t[0], x->re, x->im, MPFR_RNDN),
+	    tl = mpfr_log(res->re, t[0], MPFR_RNDN),
+	    ta = mpfr_atan2(res->im, x->im, x->re, MPFR_RNDN);
+	(void)y;
+	/* the relative error of |z| becomes absolute, below 2^-wp */
+	if (!th && !tl)
+		err[0] = EXACT;
+	else if (mpfr_zero_p(res->re))
+		err[0] = 0;
+	else
+		err[0] = wp - 1 + (mpfr_get_exp(res->re) < 0 ? mpfr_get_exp(res->re) : 0);
+	err[1] = ta ? wp - 1 : EXACT;
+}
+
+/* with t = sqrt((|z| + |a|)/2), t + i b/2t for a >= 0, |b|/2t +- i t else */
+static void cxsqrt(struct cx *res, struct cx *x, struct cx *y,
+                   mpfr_t *t, long err[2])
+{
+	mpfr_prec_t wp = mpfr_get_prec(res->re);
+	int tt, tq; mpfr_ptr r = t[0], q = t[1];
+	(void)y;
+	if (mpfr_zero_p(x->re) && mpfr_zero_p(x->im)) {
+		mpfr_set_zero(res->re, 1); mpfr_set(res->im, x->im, MPFR_RNDN);
+		err[0] = err[1] = EXACT;
+		return;
+	}
+	tt = mpfr_hypot(r, x->re, x->im, MPFR_RNDN);
+	tt |= mpfr_signbit(x->re) ? mpfr_sub(r, r, x->re, MPFR_RNDN)
+	                          : mpfr_add(r, r, x->re, MPFR_RNDN);
+	mpfr_div_2ui(r, r, 1, MPFR_RNDN);
+	tt |= mpfr_sqrt(r, r, MPFR_RNDN);
+	tq = mpfr_div(q, x->im, r, MPFR_RNDN) | tt;
+	mpfr_div_2ui(q, q, 1, MPFR_RNDN);
+	if (!mpfr_signbit(x->re)) {
+		mpfr_set(res->re, r, MPFR_RNDN); mpfr_set(res->im, q, MPFR_RNDN);
+		err[0] = tt ? wp - 1 : EXACT; err[1] = tq ? wp - 2 : EXACT;
+	} else {
+		mpfr_abs(res->re, q, MPFR_RNDN);
+		mpfr_setsign(res->im, r, mpfr_signbit(x->im), MPFR_RNDN);
+		err[0] = tq ? wp - 2 : EXACT; err[1] = tt ? wp - 1 : EXACT;
+	}
+}
+
+/* sin a cosh b + i cos a sinh b */
+static void cxsin(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_t *t, long err[2])
+{
+	int ts = mpfr_sin_cos(t[0], t[1], x->re, MPFR_RNDN),
+	    th = mpfr_sinh_cosh(t[2], t[3], x->im, MPFR_RNDN);
+	(void)y;
+	err[0] = errmul(t[0], ts & 3, t[3], th >> 2, mpfr_mul(res->re, t[0], t[3], MPFR_RNDN));
+	err[1] = errmul(t[1], ts >> 2, t[2], th & 3, mpfr_mul(res->im, t[1], t[2], MPFR_RNDN));
+}
+
+/* cos a cosh b - i sin a sinh b */
+static void cxcos(struct cx *res, struct cx *x, struct cx *y,
+                  mpfr_t *t, long err[2])
+{
+	int ts = mpfr_sin_cos(t[0], t[1], x->re, MPFR_RNDN),
+	    th = mpfr_sinh_cosh(t[2], t[3], x->im, MPFR_RNDN);
+	(void)y;
+	err[0] = errmul(t[1], ts >> 2, t[3], th >> 2, mpfr_mul(res->re, t[1], t[3], MPFR_RNDN));
+	err[1] = errmul(t[0], ts & 3, t[2], th & 3, mpfr_mul(res->im, t[0], t[2], MPFR_RNDN));
+	mpfr_neg(res->im, res->im, MPFR_RNDN);
+}
+
+static int canround(mpfr_srcptr x, long err, mpfr_srcptr res, mpfr_rnd_t rnd) {
+	if (err == EXACT) return 1;
+	if (err <= 0) return 0;
+	if (!mpfr_regular_p(x)) return 1;
+	return mpfr_can_round(x, err, MPFR_RNDN, MPFR_RNDZ,
+	                      mpfr_get_prec(res) + (rnd == MPFR_RNDN));
+}
+
+#define ZIVMAX(P) (16 * (P) + 4096) /* give up and round what we have */
+
+/* Ziv's loop: raise the working precision until both parts round right */
+static void ziv(cxapprox f, struct cx *res, struct cx *x, struct cx *y,
+                mpfr_rnd_t rnd, int ter[2])
+{
+	mpfr_prec_t p = mpfr_get_prec(res->re), wp;
+	struct cx r; mpfr_t t[4]; long err[2]; int i;
+
+	if (mpfr_get_prec(res->im) > p) p = mpfr_get_prec(res->im);
+	wp = p + 32;
+	mpfr_init2(r.re, wp); mpfr_init2(r.im, wp);
+	for (i = 0; i < 4; i++) mpfr_init2(t[i], wp);
+	for (;;) {
+		f(&r, x, y, t, err);
+		if (canround(r.re, err[0], res->re, rnd) &&
+		    canround(r.im, err[1], res->im, rnd) || wp >= ZIVMAX(p))
+			break;
+		wp += wp / 2;
+		mpfr_set_prec(r.re, wp); mpfr_set_prec(r.im, wp);
+		for (i = 0; i < 4; i++) mpfr_set_prec(t[i], wp);
+	}
+	ter[0] = mpfr_set(res->re, r.re, rnd);
+	ter[1] = mpfr_set(res->im, r.im, rnd);
+	mpfr_clear(r.re); mpfr_clear(r.im);
+	for (i = 0; i < 4; i++) mpfr_clear(t[i]);
+}
+
+#define CXBIN(L, F) do { \
+	mpfr_rnd_t rnd = settoprnd(L, 0, 3); int ter[2]; \
+	struct cx *x = checkcxarg(L, 1), *y = checkcxarg(L, 2), \
+	          *res = checkcxopt(L, 3); \
+	F; return pushcxter(L, ter); \
+} while (0)
+
+#define CXUN(L, F) do { \
+	mpfr_rnd_t rnd = settoprnd(L, 0, 2); int ter[2]; \
+	struct cx *x = checkcxarg(L, 1), *y = NULL, *res = checkcxopt(L, 2); \
+	F; return pushcxter(L, ter); \
+} while (0)
+
+static int cx_add(lua_State *L)  { CXBIN(L, cxadd(res, x, y, rnd, ter)); }
+static int cx_sub(lua_State *L)  { CXBIN(L, cxsub(res, x, y, rnd, ter)); }
+static int cx_mul(lua_State *L)  { CXBIN(L, cxmul(res, x, y, rnd, ter)); }
+static int cx_div(lua_State *L)  { CXBIN(L, ziv(cxdiv, res, x, y, rnd, ter)); }
+static int cx_neg(lua_State *L)  { CXUN(L, cxneg(res, x, y, rnd, ter)); }
+static int cx_conj(lua_State *L) { CXUN(L, cxconj(res, x, y, rnd, ter)); }
+static int cx_sqr(lua_State *L)  { CXUN(L, cxsqr(res, x, y, rnd, ter)); }
+static int cx_exp(lua_State *L)  { CXUN(L, ziv(cxexp, res, x, y, rnd, ter)); }
+static int cx_log(lua_State *L)  { CXUN(L, ziv(cxlog, res, x, y, rnd, ter)); }
+static int cx_sqrt(lua_State *L) { CXUN(L, ziv(cxsqrt, res, x, y, rnd, ter)); }
+static int cx_sin(lua_State *L)  { CXUN(L, ziv(cxsin, res, x, y, rnd, ter)); }
+static int cx_cos(lua_State *L)  { CXUN(L, ziv(cxcos, res, x, y, rnd, ter)); }
+
+static int cx_unm(lua_State *L) {
+	lua_settop(L, 1);
+	return cx_neg(L);
+}
+
+static int cx_eq(lua_State *L) {
+	struct cx *x, *y; lua_settop(L, 2);
+	x = checkcx(L, 1); y = checkcx(L, 2);
+	lua_pushboolean(L, mpfr_equal_p(x->re, y->re) && mpfr_equal_p(x->im, y->im));
+	return 1;
+}
+
+static int cx_tostring(lua_State *L) {
+	struct cx *z = checkcx(L, 1); char *s;
+	if (mpfr_asprintf(&s, "(%Rg %Rg)", z->re, z->im) < 0)
+		return luaL_error(L, "not enough memory");
+	lua_pushstring(L, s); mpfr_free_str(s);
+	return 1;
+}
+
+static int cx_gc(lua_State *L) {
+	struct cx *z = checkcx(L, 1);
+	mpfr_clear(z->re); mpfr_clear(z->im);
+	return 0;
+}
+
+static const struct luaL_Reg cxmet[] = {
+	{"__gc",       cx_gc},
+	{"__add",      cx_add},
+	{"__sub",      cx_sub},
+	{"__mul",      cx_mul},
+	{"__div",      cx_div},
+	{"__unm",      cx_unm},
+	{"__eq",       cx_eq},
+	{"__tostring", cx_tostring},
+	{"set",        cx_set},
+	{"set_prec",   cx_set_prec},
+	{"get_prec",   cx_get_prec},
+	{"re",         cx_re},
+	{"im",         cx_im},
+	{"abs",        cx_abs},
+	{"arg",        cx_arg},
+	{"norm",       cx_norm},
+	{"add",        cx_add},
+	{"sub",        cx_sub},
+	{"mul",        cx_mul},
+	{"div",        cx_div},
+	{"neg",        cx_neg},
+	{"conj",       cx_conj},
+	{"sqr",        cx_sqr},
+	{"exp",        cx_exp},
+	{"log",        cx_log},
+	{"sqrt",       cx_sqrt},
+	{"sin",        cx_sin},
+	{"cos",        cx_cos},
+	{NULL, NULL}
+};
+
+static int state_gc(lua_State *L) {
+	struct state *st = lua_touserdata(L, 1);
+	freerules(st);
+	flushmemo(&st->memo); free(st->memo.buckets);
+	return 0;
+}
+
+/* Metamethods */
+
+/* Operators never pass a rounding mode or a result, so these skip settoprnd
+ * and checkfropt and tell types apart by metatable address, looking at each
+ * operand's once, but otherwise behave like the functions of the same name.
+ * Lua picks the metamethod of the left operand, so arithmetic with a complex
+ * right one (of type CX, which type never returns) is passed on. */
+
+static int metatype(lua_State *L, int idx, const struct state *st) {
+	const void *mt;
+	if (lua_type(L, idx) != LUA_TUSERDATA)
+		return type(L, idx);
+	if (!lua_getmetatable(L, idx))
+		return UNK;
+	mt = lua_topointer(L, -1); lua_pop(L, 1);
+	if (mt == st->meta[0]) return FR;
+	if (mt == st->meta[1]) return Z;
+	if (mt == st->meta[2]) return F;
+	if (mt == st->meta[3]) return CX;
+	return UNK;
+}
+
+static int metatypes(lua_State *L, int *tyone, int *tytwo) {
+	const struct state *st = tostate(L);
+	*tyone = metatype(L, 1, st); *tytwo = metatype(L, 2, st);
+	if (*tyone == FR) return *tytwo;
+	if (*tytwo == FR) return UNK + *tyone;
+	return BAD;
+}
+
+static int meth_add(lua_State *L) {
+	mpfr_rnd_t rnd = mpfr_get_default_rounding_mode();
+	int tyone, tytwo, i, j; mpfr_t *res;
+	metatypes(L, &tyone, &tytwo);
+	i = tyone == FR ? 1 : 2; j = 3 - i;
+
+	if (tyone != FR && tytwo != FR)
+		return luaL_error(L, "bad arguments (neither is mpfr)");
+	if (tytwo == CX) return cx_add(L);
+	res = newfr(L);
+	switch (i == 1 ? tytwo : tyone) {
+	case FR: mpfr_add(*res, tofr(L, i), tofr(L, j), rnd); return 1;
+	case Z:  mpfr_add_z(*res, tofr(L, i), toz(L, j), rnd); return 1;
+	case UI: mpfr_add_ui(*res, tofr(L, i), toui(L, j), rnd); return 1;
+	case SI: mpfr_add_si(*res, tofr(L, i), tosi(L, j), rnd); return 1;
+	case D:  mpfr_add_d(*res, tofr(L, i), tod(L, j), rnd); return 1;
+	default: return typerror(L, j, "mpfr, mpz, or number");
+	}
+}
+
+static int meth_sub(lua_State *L) {
+	mpfr_rnd_t rnd = mpfr_get_default_rounding_mode();
+	int tyone, tytwo, ty = metatypes(L, &tyone, &tytwo);
+	mpfr_t *res;
+
+	if (ty == BAD) return luaL_error(L, "bad arguments (neither is mpfr)");
+	if (ty == CX) return cx_sub(L);
+	res = newfr(L);
+	switch (ty) {
+	case FR:   mpfr_sub(*res, tofr(L, 1), tofr(L, 2), rnd); return 1;
+	case FRZ:  mpfr_sub_z(*res, tofr(L, 1), toz(L, 2), rnd); return 1;
+	case ZFR:  mpfr_z_sub(*res, toz(L, 1), tofr(L, 2), rnd); return 1;
+	case FRUI: mpfr_sub_ui(*res, tofr(L, 1), toui(L, 2), rnd); return 1;
+	case UIFR: mpfr_ui_sub(*res, toui(L, 1), tofr(L, 2), rnd); return 1;
+	case FRSI: mpfr_sub_si(*res, tofr(L, 1), tosi(L, 2), rnd); return 1;
+	case SIFR: mpfr_si_sub(*res, tosi(L, 1), tofr(L, 2), rnd); return 1;
+	case FRD:  mpfr_sub_d(*res, tofr(L, 1), tod(L, 2), rnd); return 1;
+	case DFR:  mpfr_d_sub(*res, tod(L, 1), tofr(L, 2), rnd); return 1;
+	default:   return typerror(L, tyone == FR ? 2 : 1, "mpfr, mpz, or number");
+	}
+}
+
+static int meth_mul(lua_State *L) {
+	mpfr_rnd_t rnd = mpfr_get_default_rounding_mode();
+	int tyone, tytwo, i, j; mpfr_t *res;
+	metatypes(L, &tyone, &tytwo);
+	i = tyone == FR ? 1 : 2; j = 3 - i;
+
+	if (tyone != FR && tytwo != FR)
+		return luaL_error(L, "bad arguments (neither is mpfr)");
+	if (tytwo == CX) return cx_mul(L);
+	res = newfr(L);
+	switch (i == 1 ? tytwo : tyone) {
+	case FR: pmul(tostate(L), *res, tofr(L, i), tofr(L, j), rnd); return 1;
+	case Z:  mpfr_mul_z(*res, tofr(L, i), toz(L, j), rnd); return 1;
+	case UI: mpfr_mul_ui(*res, tofr(L, i), toui(L, j), rnd); return 1;
+	case SI: mpfr_mul_si(*res, tofr(L, i), tosi(L, j), rnd); return 1;
+	case D:  mpfr_mul_d(*res, tofr(L, i), tod(L, j), rnd); return 1;
+	default: return typerror(L, j, "mpfr, mpz, or number");
+	}
+}
+
+static int meth_div(lua_State *L) {
+	mpfr_rnd_t rnd = mpfr_get_default_rounding_mode();
+	int tyone, tytwo, ty = metatypes(L, &tyone, &tytwo);
+	mpfr_t *res;
+
+	if (ty == BAD) return luaL_error(L, "bad arguments (neither is mpfr)");
+	if (ty == CX) return cx_div(L);
+	res = newfr(L);
+	switch (ty) {
+	case FR:   pdiv(tostate(L), *res, tofr(L, 1), tofr(L, 2), rnd); return 1;
+	case FRZ:  mpfr_div_z(*res, tofr(L, 1), toz(L, 2), rnd); return 1;
+	case FRUI: mpfr_div_ui(*res, tofr(L, 1), toui(L, 2), rnd); return 1;
+	case UIFR: mpfr_ui_div(*res, toui(L, 1), tofr(L, 2), rnd); return 1;
+	case FRSI: mpfr_div_si(*res, tofr(L, 1), tosi(L, 2), rnd); return 1;
+	case SIFR: mpfr_si_div(*res, tosi(L, 1), tofr(L, 2), rnd); return 1;
+	case FRD:  mpfr_div_d(*res, tofr(L, 1), tod(L, 2), rnd); return 1;
+	case DFR:  mpfr_d_div(*res, tod(L, 1), tofr(L, 2), rnd); return 1;
+	default:
+		if (tyone == FR) return typerror(L, 2, "mpfr, mpz, or number");
+		else return typerror(L, 1, "mpfr or number");
+	}
+}
+
+static int meth_pow(lua_State *L) {
+	mpfr_rnd_t rnd = mpfr_get_default_rounding_mode();
+	int tyone, tytwo, ty = metatypes(L, &tyone, &tytwo);
+	mpfr_t *res;
+
+	if (ty == BAD && !(tyone == UI && tytwo == UI))
+		return luaL_error(L, "bad arguments (neither is mpfr)");
+	res = newfr(L);
+	switch (ty) {
+	case FR:   mpfr_pow(*res, tofr(L, 1), tofr(L, 2), rnd); return 1;
+	case FRZ:  mpfr_pow_z(*res, tofr(L, 1), toz(L, 2), rnd); return 1;
+	case FRUI: mpfr_pow_ui(*res, tofr(L, 1), toui(L, 2), rnd); return 1;
+	case UIFR: mpfr_ui_pow(*res, toui(L, 1), tofr(L, 2), rnd); return 1;
+	case FRSI: mpfr_pow_si(*res, tofr(L, 1), tosi(L, 2), rnd); return 1;
+	case BAD:  mpfr_ui_pow_ui(*res, toui(L, 1), toui(L, 2), rnd); return 1;
+	default:
+		if (tyone == FR) return typerror(L, 2, "mpfr, mpz, or integer");
+		else return typerror(L, 1, "mpfr or non-negative integer");
+	}
+}
+
+static int meth_unm(lua_State *L) {
+	mpfr_t *res;
+	if (metatype(L, 1, tostate(L)) != FR) return typerror(L, 1, "mpfr");
+	res = newfr(L);
+	mpfr_neg(*res, tofr(L, 1), mpfr_get_default_rounding_mode());
+	return 1;
+}
+
+#define METAREL(L, P) do { \
+	const struct state *st = tostate(L); \
+	if (metatype(L, 1, st) != FR) return typerror(L, 1, "mpfr"); \
+	if (metatype(L, 2, st) != FR) return typerror(L, 2, "mpfr"); \
+	lua_pushboolean(L, mpfr_ ## P ## _p (tofr(L, 1), tofr(L, 2))); return 1; \
+} while (0)
+
+/* FIXME nan == nan */
+static int meth_lt(lua_State *L) { METAREL(L, less); }
+static int meth_le(lua_State *L) { METAREL(L, lessequal); }
+static int meth_eq(lua_State *L) { METAREL(L, equal); }
+
+/* C interface, see lmpfr.h */
+
+/* the state of the instance in this Lua state, for callers without our
+ * upvalues; its published struct lmpfr is its first member */
+static const struct state *apistate(lua_State *L) {
+	const struct state *st;
+	lua_getfield(L, LUA_REGISTRYINDEX, LMPFR_REGISTRY);
+	st = lua_touserdata(L, -1); lua_pop(L, 1);
+	return st;
+}
+
+/* like type, for callers without our upvalues */
+static int apitype(lua_State *L, int idx) {
+	int ret = metatype(L, idx, apistate(L));
+	return ret == CX ? UNK : ret;
+}
+
+static mpfr_t *api_test(lua_State *L, int idx) {
+	return apitype(L, idx) == FR ? lua_touserdata(L, idx) : NULL;
+}
+
+static mpfr_t *api_check(lua_State *L, int idx) {
+	if (apitype(L, idx) != FR)
+		typerror(L, idx, "mpfr");
+	return lua_touserdata(L, idx);
+}
+
+static mpfr_t *api_create(lua_State *L, mpfr_prec_t prec) {
+	mpfr_t *p = newudata(L, sizeof *p);
+	if (prec) mpfr_init2(*p, prec); else mpfr_init(*p);
+	lua_getfield(L, LUA_REGISTRYINDEX, LMPFR_FRMETA);
+	lua_setmetatable(L, -2);
+	return p;
+}
+
+static mpfr_t *api_push(lua_State *L, mpfr_srcptr op) {
+	mpfr_t *p = api_create(L, mpfr_get_prec(op));
+	mpfr_set(*p, op, MPFR_RNDN);
+	return p;
+}
+
+static mpz_t *api_testz(lua_State *L, int idx) {
+	return apitype(L, idx) == Z ? lua_touserdata(L, idx) : NULL;
+}
+
+static mpf_t *api_testf(lua_State *L, int idx) {
+	return apitype(L, idx) == F ? lua_touserdata(L, idx) : NULL;
+}
+
+static int api_set(lua_State *L, int idx, mpfr_ptr rop, mpfr_rnd_t rnd) {
+	switch (apitype(L, idx)) {
+	case FR: return mpfr_set(rop, tofr(L, idx), rnd);
+	case Z:  return mpfr_set_z(rop, toz(L, idx), rnd);
+	case F:  return mpfr_set_f(rop, tof(L, idx), rnd);
+	case UI: return mpfr_set_ui(rop, toui(L, idx), rnd);
+	case SI: return mpfr_set_si(rop, tosi(L, idx), rnd);
+	case D:  return mpfr_set_d(rop, tod(L, idx), rnd);
+	default: return typerror(L, idx, "mpfr, mpf, mpz, or number");
+	}
+}
+
+static const struct lmpfr api = {
+	LMPFR_VERSION,
+	api_test, api_check, api_create, api_push,
+	api_testz, api_testf, api_set,
+};
+
+#ifdef LMPFR_SDT
+/* Tracing */
+
+/* the greatest precision of the mpfr arguments, 0 if there are none */
+static long argprec(lua_State *L, int low, int high) {
+	long prec = 0; int i;
+	for (i = low; i <= high; i++)
+		if (isfr(L, i) && mpfr_get_prec(tofr(L, i)) > prec)
+			prec = mpfr_get_prec(tofr(L, i));
+	return prec;
+}
+
+/* like settoprnd, but without touching the stack or raising errors */
+static int argrnd(lua_State *L) {
+	struct context *ctx = toctx(L);
+	int top = lua_gettop(L), i;
+	if (top && lua_type(L, top) == LUA_TSTRING && !lua_isnumber(L, top) &&
+	    (i = findrnd(lua_tostring(L, top))) >= 0)
+		return rnds[i];
+	return ctx ? ctx->rnd : mpfr_get_default_rounding_mode();
+}
+
+/* the function in l, firing lmpfr:entry with its name, the precision of the
+ * arguments and the rounding mode, and lmpfr:exit with its name, the
+ * precision of the results and their count unless it raises an error */
+static int traced(lua_State *L) {
+	const luaL_Reg *l = lua_touserdata(L, lua_upvalueindex(NUPP1));
+	int n;
+	if (PROBED(entry))
+		DTRACE_PROBE3(lmpfr, entry, l->name, argprec(L, 1, lua_gettop(L)), argrnd(L));
+	n = l->func(L);
+	if (PROBED(exit))
+		DTRACE_PROBE3(lmpfr, exit, l->name, argprec(L, lua_gettop(L) - n + 1, lua_gettop(L)), n);
+	return n;
+}
+#endif
+
+/* l->func closed over the nup values at the top of the stack, traced if
+ * compiled with probes */
+static void pushfunc(lua_State *L, const luaL_Reg *l, int nup) {
+#ifdef LMPFR_SDT
+	lua_pushlightuserdata(L, (void *)l);
+	lua_pushcclosure(L, traced, nup + 1);
+#else
+	lua_pushcclosure(L, l->func, nup);
+#endif
+}
+
+static void setfuncs(lua_State *L, int idx, const luaL_Reg *l, int nup) {
+	lua_pushvalue(L, idx);
+	for (; l->name; l++) {
+		int i;
+		for (i = 0; i < nup; i++) lua_pushvalue(L, -(nup + 1));
+		pushfunc(L, l, nup);
+		lua_setfield(L, -2, l->name);
+	}
+	lua_pop(L, 1);
+}
+
+static int context(lua_State *L);
+
+static const struct luaL_Reg mod[] = {
+	{"fr", fr},
+	{"context", context},
+	{"integrate", integrate},
+	{"newton", newton},
+	{"invert", invert},
+	{"sort", sort},
+	{"argsort", argsort},
+	{"minmax", minmax},
+	{"searchsorted", searchsorted},
+	{"memoize", memoize},
+	{"memo_stats", memo_stats},
+	{"memo_flush", memo_flush},
+	{"set_threads", set_threads},
+	{"get_threads", get_threads},
+	{"from_numbers", from_numbers},
+	{"to_numbers", to_numbers},
+	{"cumsum", cumsum},
+	{"cumprod", cumprod},
+	{"approximate", approximate},
+	{"complex", complex_},
+	{"set_default_prec", set_default_prec},
+	{"get_default_prec", get_default_prec},
+	{"set_default_rounding_mode", set_default_rounding_mode},
+	{"get_default_rounding_mode", get_default_rounding_mode},
+	{"sqrt", sqrt_},
+	{"log", log_},
+	{"pow", pow_},
+	{"atan2", atan2_},
+	{"beta", beta},
+	{"zeta", zeta},
+	{"jn", jn_},
+	{"yn", yn_},
+	{"agm", agm},
+	{0},
+};
+
+static const struct luaL_Reg met[] = {
+	{"__gc",       meth_gc},
+	{"__add",      meth_add},
+	{"__sub",      meth_sub},
+	{"__mul",      meth_mul},
+	{"__div",      meth_div},
+	/* FIXME __mod with quotient to -inf */
+	{"__pow",      meth_pow},
+	{"__unm",      meth_unm},
+	{"__concat",   meth_concat},
+	{"__lt",       meth_lt},
+	{"__le",       meth_le},
+	{"__eq",       meth_eq},
+	{"__ge",       ge},
+	{"__gt",       gt},
+	{"__tostring", meth_tostring},
+	/* .1 Initialization functions */
+	{"set_prec",   set_prec},
+	{"get_prec",   get_prec},
+	/* .2 Assignment functions */
+	{"set",        set},
+	/* .4 Conversion functions */
+	{"get_d",      get_d},
+	{"get_si",     get_si},
+	{"get_ui",     get_ui},
+	{"get_sj",     get_sj},
+	{"get_uj",     get_uj},
+	{"get_d_2exp", get_d_2exp},
+	{"get_str",    get_str},
+	{"fits_ulong",   fits_ulong},
+	{"fits_slong",   fits_slong},
+	{"fits_uint",    fits_uint},
+	{"fits_sint",    fits_sint},
+	{"fits_ushort",  fits_ushort},
+	{"fits_sshort",  fits_sshort},
+	{"fits_uintmax", fits_uintmax},
+	{"fits_intmax",  fits_intmax},
+	/* .5 Arithmetic functions */
+	{"add",        add},
+	{"sub",        sub},
+	{"rsub",       rsub},
+	{"mul",        mul},
+	{"div",        div_},
+	{"rdiv",       rdiv},
+	{"sqrt",       sqrt_},
+	{"rsqrt",      rec_sqrt}, /* more common name */
+	{"rec_sqrt",   rec_sqrt},
+	{"cbrt",       cbrt_},
+	{"rootn",      rootn},
+	{"neg",        neg},
+	{"abs",        abs_},
+	{"mul_2exp",   mul_2exp},
+	{"div_2exp",   div_2exp},
+	/* .6 Comparison functions */
+	{"cmp",        cmp},
+	{"nan",        nan_},
+	{"inf",        inf},
+	{"number",     number},
+	{"zero",       zero},
+	{"regular",    regular},
+	{"sgn",        sgn},
+	/* .7 Transcendental functions */
+	{"log",        log_},
+	{"log2",       log2_},
+	{"log10",      log10_},
+	{"log1p",      log1p_},
+	{"exp",        exp_},
+	{"exp2",       exp2_},
+	{"exp10",      exp10_},
+	{"expm1",      expm1_},
+	{"pow",        pow_},
+	{"rpow",       rpow},
+	{"cos",        cos_},
+	{"sin",        sin_},
+	{"tan",        tan_},
+	{"sincos",     sin_cos}, /* more common name */
+	{"sin_cos",    sin_cos},
+	{"sec",        sec},
+	{"csc",        csc},
+	{"cot",        cot},
+	{"acos",       acos_},
+	{"asin",       asin_},
+	{"atan",       atan_},
+	{"atan2",      atan2_},
+	{"cosh",       cosh_},
+	{"sinh",       sinh_},
+	{"tanh",       tanh_},
+	{"sincosh",    sinh_cosh}, /* by analogy with sincos() */
+	{"sinh_cosh",  sinh_cosh},
+	{"sech",       sech},
+	{"csch",       csch},
+	{"coth",       coth},
+	{"acosh",      acosh_},
+	{"asinh",      asinh_},
+	{"atanh",      atanh_},
+	{"eint",       eint},
+	{"li2",        li2},
+	{"gamma",      gamma_},
+	{"tgamma",     gamma_}, /* C99 name */
+	{"lngamma",    lngamma},
+	{"lgamma",     lgamma_},
+	{"digamma",    digamma},
+	{"beta",       beta},
+	{"zeta",       zeta},
+	{"erf",        erf_},
+	{"erfc",       erfc_},
+	{"j0",         j0_},
+	{"j1",         j1_},
+	{"jn",         jn_},
+	{"y0",         y0_},
+	{"y1",         y1_},
+	{"yn",         yn_},
+	{"ai",         ai},
+	{"agm",        agm},
+	/* .9 Formatted output functions */
+	{"format",     format},
+	/* .10 Integer and remainder related functions */
+	{"rint",       rint_},
+	{"ceil",       ceil_},
+	{"floor",      floor_},
+	{"round",      round_},
+	{"roundeven",  roundeven_},
+	{"trunc",      trunc_},
+	{"integer",    integer},
+	/* .11 Rounding-related functions */
+	{"prec_round", prec_round},
+	{0},
+};
+
+/* Contexts */
+
+static void pushbound(lua_State *L, const luaL_Reg *l, int ctx) {
+	int i;
+	for (i = 1; i <= NUP; i++)
+		lua_pushvalue(L, i == CTX ? ctx : lua_upvalueindex(i));
+	pushfunc(L, l, NUP);
+}
+
+static int context(lua_State *L) {
+	static const luaL_Reg frreg = {"fr", fr};
+	struct context *ctx; const luaL_Reg *l; lua_Number prec; int rnd;
+	luaL_checktype(L, 1, LUA_TTABLE); lua_settop(L, 1);
+	lua_getfield(L, 1, "prec");
+	lua_getfield(L, 1, "rnd");
+
+	/* the fields are checked here so that errors name them, not #2 and #3 */
+	prec = lua_isnil(L, 2) ? mpfr_get_default_prec() : lua_tonumber(L, 2);
+	if (!lua_isnil(L, 2) && !lua_isnumber(L, 2))
+		return luaL_argerror(L, 1, "field 'prec' is not a number");
+	if (prec != floor(prec) || !(MPFR_PREC_MIN <= prec && prec <= MPFR_PREC_MAX))
+		return luaL_argerror(L, 1, "field 'prec' out of range");
+	if (lua_isnil(L, 3))
+		rnd = -1;
+	else if (lua_type(L, 3) != LUA_TSTRING || (rnd = findrnd(lua_tostring(L, 3))) < 0)
+		return luaL_argerror(L, 1, "field 'rnd' is not a valid rounding mode");
+
+	ctx = lua_newuserdata(L, sizeof *ctx);
+	ctx->prec = prec;
+	ctx->rnd = rnd < 0 ? mpfr_get_default_rounding_mode() : rnds[rnd];
+
+	lua_createtable(L, 0, sizeof met / sizeof met[0]);
+	pushbound(L, &frreg, 4); lua_setfield(L, -2, "fr");
+	for (l = met; l->name; l++) {
+		if (l->name[0] == '_' && l->name[1] == '_')
+			continue; /* metamethods */
+		pushbound(L, l, 4); lua_setfield(L, -2, l->name);
+	}
+	return 1;
+}
+
+static void loadgmp(lua_State *L) {
+	int frmeta = lua_gettop(L), gmp = frmeta + 1;
+
+	lua_getglobal(L, "require");
+	lua_pushstring(L, "gmp");
+	if (lua_pcall(L, 1, 1, 0)) {
+		lua_pop(L, 1); lua_newtable(L);
+	}
+
+	lua_getfield(L, gmp, "z");
+	if (lua_pcall(L, 0, 1, 0) || !lua_isuserdata(L, -1) || !lua_getmetatable(L, -1))
+		lua_pushvalue(L, frmeta);
+	lua_remove(L, -2);
+
+	lua_getfield(L, gmp, "f");
+	if (lua_pcall(L, 0, 1, 0) || !lua_isuserdata(L, -1) || !lua_getmetatable(L, -1))
+		lua_pushvalue(L, frmeta);
+	lua_remove(L, -2);
+
+	lua_remove(L, gmp);
+}
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int luaopen_mpfr_core(lua_State *L) {
+	struct state *st;
+	lua_settop(L, 0);
+
+	/* mpfr (but for mpfr.ffi under LuaJIT) and mpfr.core share one instance,
+	 * whose values they all accept */
+	lua_getfield(L, LUA_REGISTRYINDEX, LMPFR_MODULE);
+	if (lua_istable(L, 1)) return 1;
+	lua_pop(L, 1);
+
+	lua_createtable(L, 0, sizeof mod / sizeof mod[0] - 1);
+
+	lua_createtable(L, 0, sizeof met / sizeof met[0] - 1);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pushvalue(L, -1); /* FRMETA */
+	loadgmp(L); /* ZMETA, FMETA */
+	lua_pushnil(L); /* CTX */
+	st = lua_newuserdata(L, sizeof *st);
+	memset(st, 0, sizeof *st);
+	st->api = api;
+	st->nthread = 1; st->threshold = THRESHOLD;
+	st->tls = mpfr_buildopt_tls_p();
+	st->meta[0] = lua_topointer(L, 3);
+	st->meta[1] = lua_topointer(L, 4);
+	st->meta[2] = lua_topointer(L, 5);
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, state_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_setmetatable(L, -2); /* STATE */
+	lua_createtable(L, 0, sizeof apmet / sizeof apmet[0]);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index"); /* APMETA */
+	lua_createtable(L, 0, sizeof cxmet / sizeof cxmet[0]);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index"); /* CXMETA */
+	st->meta[3] = lua_topointer(L, 9);
+
+	lua_pushvalue(L, 3);
+	lua_setfield(L, LUA_REGISTRYINDEX, LMPFR_FRMETA);
+	if (!lua_rawequal(L, 4, 3)) {
+		lua_pushvalue(L, 4);
+		lua_setfield(L, LUA_REGISTRYINDEX, LMPFR_ZMETA);
+	}
+	if (!lua_rawequal(L, 5, 3)) {
+		lua_pushvalue(L, 5);
+		lua_setfield(L, LUA_REGISTRYINDEX, LMPFR_FMETA);
+	}
+	lua_pushlightuserdata(L, &st->api); /* kept alive by our upvalues */
+	lua_setfield(L, LUA_REGISTRYINDEX, LMPFR_REGISTRY);
+	lua_pushvalue(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, LMPFR_MODULE);
+
+	setfuncs(L, 1, mod, NUP);
+	setfuncs(L, 2, met, NUP);
+	setfuncs(L, 8, apmet, NUP);
+	setfuncs(L, 9, cxmet, NUP);
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* LuaJIT can compile calls through its FFI but not through this module, so
+ * there mpfr is mpfr.ffi, unless that cannot be loaded (without the FFI, or
+ * when it cannot find the MPFR library) */
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int luaopen_mpfr(lua_State *L) {
+	lua_getglobal(L, "jit");
+	if (lua_istable(L, -1)) {
+		lua_getglobal(L, "require");
+		lua_pushliteral(L, "mpfr.ffi");
+		if (!lua_pcall(L, 1, 1, 0)) return 1;
+		/* so that requiring it again reports the error, not a loop */
+		lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+		lua_pushnil(L);
+		lua_setfield(L, -2, "mpfr.ffi");
+	}
+	return luaopen_mpfr_core(L);
 }
@@ -0,0 +1,1187 @@
+-- LuaJIT FFI implementation of the mpfr module, which require 'mpfr'
+-- returns under LuaJIT, so that calls into MPFR from Lua code are visible to
+-- the trace compiler instead of aborting it.  Values are cdata rather than
+-- userdata.  What is not implemented here is forwarded to the C module
+-- mpfr.core, copying values to and from its userdata on the way.
+
+local ffi = require 'ffi'
+
+local error, getmetatable, ipairs, pairs, pcall, require, select,
+      setmetatable, tonumber, type, unpack =
+      error, getmetatable, ipairs, pairs, pcall, require, select,
+      setmetatable, tonumber, type, unpack
+local floor = math.floor
+
+ffi.cdef [[
+typedef long mpfr_prec_t;
+typedef int  mpfr_sign_t;
+typedef long mpfr_exp_t;
+typedef int  mpfr_rnd_t;
+typedef struct {
+	mpfr_prec_t _mpfr_prec;
+	mpfr_sign_t _mpfr_sign;
+	mpfr_exp_t  _mpfr_exp;
+	void       *_mpfr_d;
+} __mpfr_struct;
+typedef __mpfr_struct *mpfr_ptr;
+typedef const __mpfr_struct *mpfr_srcptr;
+typedef struct { int _mp_alloc; int _mp_size; void *_mp_d; } __mpz_struct;
+typedef struct { int _mp_prec; int _mp_size; long _mp_exp; void *_mp_d; } __mpf_struct;
+typedef const __mpz_struct *mpz_srcptr;
+typedef const __mpf_struct *mpf_srcptr;
+
+void mpfr_init(mpfr_ptr);
+void mpfr_init2(mpfr_ptr, mpfr_prec_t);
+void mpfr_clear(mpfr_ptr);
+void mpfr_set_default_prec(mpfr_prec_t);
+mpfr_prec_t mpfr_get_default_prec(void);
+void mpfr_set_default_rounding_mode(mpfr_rnd_t);
+mpfr_rnd_t mpfr_get_default_rounding_mode(void);
+void mpfr_set_prec(mpfr_ptr, mpfr_prec_t);
+mpfr_prec_t mpfr_get_prec(mpfr_srcptr);
+int mpfr_prec_round(mpfr_ptr, mpfr_prec_t, mpfr_rnd_t);
+
+int mpfr_set(mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_set_z(mpfr_ptr, mpz_srcptr, mpfr_rnd_t);
+int mpfr_set_f(mpfr_ptr, mpf_srcptr, mpfr_rnd_t);
+int mpfr_set_ui(mpfr_ptr, unsigned long, mpfr_rnd_t);
+int mpfr_set_si(mpfr_ptr, long, mpfr_rnd_t);
+int mpfr_set_d(mpfr_ptr, double, mpfr_rnd_t);
+int __gmpfr_set_sj(mpfr_ptr, int64_t, mpfr_rnd_t);
+int mpfr_strtofr(mpfr_ptr, const char *, char **, int, mpfr_rnd_t);
+
+double mpfr_get_d(mpfr_srcptr, mpfr_rnd_t);
+double mpfr_get_d_2exp(long *, mpfr_srcptr, mpfr_rnd_t);
+long mpfr_get_si(mpfr_srcptr, mpfr_rnd_t);
+unsigned long mpfr_get_ui(mpfr_srcptr, mpfr_rnd_t);
+int64_t __gmpfr_mpfr_get_sj(mpfr_srcptr, mpfr_rnd_t);
+uint64_t __gmpfr_mpfr_get_uj(mpfr_srcptr, mpfr_rnd_t);
+char *mpfr_get_str(char *, mpfr_exp_t *, int, size_t, mpfr_srcptr, mpfr_rnd_t);
+void mpfr_free_str(char *);
+int mpfr_fits_ulong_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_slong_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_uint_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_sint_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_ushort_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_sshort_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_uintmax_p(mpfr_srcptr, mpfr_rnd_t);
+int mpfr_fits_intmax_p(mpfr_srcptr, mpfr_rnd_t);
+
+int mpfr_add(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_add_z(mpfr_ptr, mpfr_srcptr, mpz_srcptr, mpfr_rnd_t);
+int mpfr_add_ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_add_si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+int mpfr_add_d(mpfr_ptr, mpfr_srcptr, double, mpfr_rnd_t);
+int mpfr_sub(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_sub_z(mpfr_ptr, mpfr_srcptr, mpz_srcptr, mpfr_rnd_t);
+int mpfr_z_sub(mpfr_ptr, mpz_srcptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_sub_ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_ui_sub(mpfr_ptr, unsigned long, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_sub_si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+int mpfr_si_sub(mpfr_ptr, long, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_sub_d(mpfr_ptr, mpfr_srcptr, double, mpfr_rnd_t);
+int mpfr_d_sub(mpfr_ptr, double, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_mul(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_mul_z(mpfr_ptr, mpfr_srcptr, mpz_srcptr, mpfr_rnd_t);
+int mpfr_mul_ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_mul_si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+int mpfr_mul_d(mpfr_ptr, mpfr_srcptr, double, mpfr_rnd_t);
+int mpfr_div(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_div_z(mpfr_ptr, mpfr_srcptr, mpz_srcptr, mpfr_rnd_t);
+int mpfr_div_ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_ui_div(mpfr_ptr, unsigned long, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_div_si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+int mpfr_si_div(mpfr_ptr, long, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_div_d(mpfr_ptr, mpfr_srcptr, double, mpfr_rnd_t);
+int mpfr_d_div(mpfr_ptr, double, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_sqrt_ui(mpfr_ptr, unsigned long, mpfr_rnd_t);
+int mpfr_rootn_ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_mul_2ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_mul_2si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+int mpfr_div_2ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_div_2si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+
+int mpfr_cmp(mpfr_srcptr, mpfr_srcptr);
+int mpfr_cmp_z(mpfr_srcptr, mpz_srcptr);
+int mpfr_cmp_f(mpfr_srcptr, mpf_srcptr);
+int mpfr_cmp_ui(mpfr_srcptr, unsigned long);
+int mpfr_cmp_si(mpfr_srcptr, long);
+int mpfr_cmp_d(mpfr_srcptr, double);
+int mpfr_nan_p(mpfr_srcptr);
+int mpfr_inf_p(mpfr_srcptr);
+int mpfr_number_p(mpfr_srcptr);
+int mpfr_zero_p(mpfr_srcptr);
+int mpfr_regular_p(mpfr_srcptr);
+int mpfr_integer_p(mpfr_srcptr);
+int mpfr_sgn(mpfr_srcptr);
+int mpfr_less_p(mpfr_srcptr, mpfr_srcptr);
+int mpfr_lessequal_p(mpfr_srcptr, mpfr_srcptr);
+int mpfr_equal_p(mpfr_srcptr, mpfr_srcptr);
+int mpfr_greaterequal_p(mpfr_srcptr, mpfr_srcptr);
+int mpfr_greater_p(mpfr_srcptr, mpfr_srcptr);
+int mpfr_erangeflag_p(void);
+
+int mpfr_log_ui(mpfr_ptr, unsigned long, mpfr_rnd_t);
+int mpfr_pow(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_pow_z(mpfr_ptr, mpfr_srcptr, mpz_srcptr, mpfr_rnd_t);
+int mpfr_pow_ui(mpfr_ptr, mpfr_srcptr, unsigned long, mpfr_rnd_t);
+int mpfr_ui_pow(mpfr_ptr, unsigned long, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_pow_si(mpfr_ptr, mpfr_srcptr, long, mpfr_rnd_t);
+int mpfr_ui_pow_ui(mpfr_ptr, unsigned long, unsigned long, mpfr_rnd_t);
+int mpfr_sin_cos(mpfr_ptr, mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_sinh_cosh(mpfr_ptr, mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_lgamma(mpfr_ptr, int *, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_zeta_ui(mpfr_ptr, unsigned long, mpfr_rnd_t);
+int mpfr_jn(mpfr_ptr, long, mpfr_srcptr, mpfr_rnd_t);
+int mpfr_yn(mpfr_ptr, long, mpfr_srcptr, mpfr_rnd_t);
+
+int mpfr_asprintf(char **, const char *, ...);
+
+int mpfr_ceil(mpfr_ptr, mpfr_srcptr);
+int mpfr_floor(mpfr_ptr, mpfr_srcptr);
+int mpfr_round(mpfr_ptr, mpfr_srcptr);
+int mpfr_roundeven(mpfr_ptr, mpfr_srcptr);
+int mpfr_trunc(mpfr_ptr, mpfr_srcptr);
+]]
+
+-- the unary and binary functions share a signature, declare them in bulk
+local unary = {
+	'sqrt', 'rec_sqrt', 'cbrt', 'neg', 'abs', 'log', 'log2', 'log10',
+	'log1p', 'exp', 'exp2', 'exp10', 'expm1', 'cos', 'sin', 'tan', 'sec',
+	'csc', 'cot', 'acos', 'asin', 'atan', 'cosh', 'sinh', 'tanh', 'sech',
+	'csch', 'coth', 'acosh', 'asinh', 'atanh', 'eint', 'li2', 'gamma',
+	'lngamma', 'digamma', 'zeta', 'erf', 'erfc', 'j0', 'j1', 'y0', 'y1', 'ai',
+	'rint',
+}
+local binary = { 'atan2', 'beta', 'agm' }
+do
+	local decls = {}
+	for i = 1, #unary do
+		decls[#decls + 1] = ('int mpfr_%s(mpfr_ptr, mpfr_srcptr, mpfr_rnd_t);'):format(unary[i])
+	end
+	for i = 1, #binary do
+		decls[#decls + 1] = ('int mpfr_%s(mpfr_ptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);'):format(binary[i])
+	end
+	ffi.cdef(table.concat(decls, '\n'))
+end
+
+-- the library under its development name, the executable if linked in, or
+-- the library under its runtime names
+local C do
+	for _, name in ipairs { 'mpfr', false, 'libmpfr.so.6', 'libmpfr.6.dylib' } do
+		local ok, lib = pcall(function()
+			local lib = name and ffi.load(name) or ffi.C
+			local _ = lib.mpfr_get_default_prec
+			return lib
+		end)
+		if ok then C = lib; break end
+	end
+	if not C then error('mpfr.ffi: cannot find the MPFR library', 0) end
+end
+
+local frct = ffi.typeof '__mpfr_struct'
+local zptr = ffi.typeof 'const __mpz_struct *'
+local fptr = ffi.typeof 'const __mpf_struct *'
+local istype = ffi.istype
+
+-- value classification, mirrors type() in mpfr.c
+local FR, Z, F, UI, SI, D, NIL, STR, UNK = 0, 1, 2, 3, 4, 5, 6, 7, 8
+
+local ULONG_LIM = 2^(8 * ffi.sizeof 'long')
+local LONG_LIM  = 2^(8 * ffi.sizeof 'long' - 1)
+
+local zmeta, fmeta do
+	local ok, gmp = pcall(require, 'gmp')
+	if ok and type(gmp) == 'table' then
+		local okz, z = pcall(gmp.z); if okz then zmeta = getmetatable(z) end
+		local okf, f = pcall(gmp.f); if okf then fmeta = getmetatable(f) end
+	end
+end
+
+local function kind(v)
+	local t = type(v)
+	if t == 'cdata' then
+		return istype(frct, v) and FR or UNK
+	elseif t == 'number' then
+		if v == floor(v) then
+			if 0 <= v and v < ULONG_LIM then return UI end
+			if -LONG_LIM <= v and v < LONG_LIM then return SI end
+		end
+		return D
+	elseif t == 'userdata' then
+		local mt = getmetatable(v)
+		if mt ~= nil and mt == zmeta then return Z end
+		if mt ~= nil and mt == fmeta then return F end
+	elseif t == 'nil' then
+		return NIL
+	elseif t == 'string' then
+		return STR
+	end
+	return UNK
+end
+
+local function toz(v) return ffi.cast(zptr, v) end
+local function tof(v) return ffi.cast(fptr, v) end
+
+local function argerror(i, fname, msg)
+	error(("bad argument #%d to '%s' (%s)"):format(i, fname, msg), 3)
+end
+
+local function typerror(i, fname, tname, v)
+	argerror(i, fname, ("%s expected, got %s"):format(tname, type(v)))
+end
+
+local function isfr(v) return istype(frct, v) end
+
+local PREC_MAX = LONG_LIM - 257
+
+local function checkprec(p, i, fname)
+	if type(p) ~= 'number' or p ~= floor(p) or p < 1 or p > PREC_MAX then
+		argerror(i, fname, 'precision out of range')
+	end
+	return p
+end
+
+local opts = { A = 4, U = 2, D = 3, Y = 4, Z = 1, N = 0, F = 5 }
+local rnds = {}
+for k, v in pairs(opts) do rnds[k] = v; rnds[k:lower()] = v end
+local modes = { [0] = 'N', 'Z', 'U', 'D', 'A', 'F' }
+
+local gc = { __gc = function(self) C.mpfr_clear(self) end }
+
+-- All values are made here, so that none escapes the __gc metamethod above.
+local function newprec(prec)
+	local p = ffi.new(frct)
+	if prec then C.mpfr_init2(p, prec) else C.mpfr_init(p) end
+	return p
+end
+
+-- Forwarding to mpfr.core.  Arguments are copied down to it: cdata values
+-- into userdata ones, tables elementwise, and functions wrapped to copy their
+-- arguments up and results down in turn.  Results are copied up: userdata
+-- values into cdata ones, other objects of mpfr.core (complex numbers,
+-- approximations) wrapped in proxies, and copies made on the way down back
+-- into their originals, so that result arguments work.  The states that
+-- memoize and set_threads change are in mpfr.core and are tracked here, so
+-- they should be changed through this module.
+
+local core = require 'mpfr.core'
+local coremeta = getmetatable((core.fr()))
+local frptr = ffi.typeof '__mpfr_struct *'
+
+local down, up, forward
+local pmeta = {}
+local proxies = setmetatable({}, { __mode = 'kv' })
+
+local function isproxy(v)
+	return type(v) == 'table' and getmetatable(v) == pmeta
+end
+
+local function mapall(f, c, ...)
+	local n = select('#', ...)
+	if n == 0 then return end
+	local t = { ... }
+	for i = 1, n do t[i] = f(t[i], c) end
+	return unpack(t, 1, n)
+end
+
+function down(v, c)
+	local t = type(v)
+	if t == 'cdata' and isfr(v) then
+		local u = core.fr()
+		local p = ffi.cast(frptr, u)
+		C.mpfr_set_prec(p, C.mpfr_get_prec(v))
+		C.mpfr_set(p, v, 0) -- exact
+		c[u] = v
+		return u
+	elseif t == 'table' then
+		if getmetatable(v) == pmeta then return v[1] end
+		local copy = {}
+		for k, e in pairs(v) do copy[k] = down(e, c) end
+		c[copy] = v
+		return copy
+	elseif t == 'function' then
+		return function(...)
+			local d = {}
+			return mapall(down, d, v(mapall(up, d, ...)))
+		end
+	end
+	return v
+end
+
+function up(v, c)
+	local o = c[v]
+	if o ~= nil then
+		if type(v) == 'table' then
+			for k, e in pairs(v) do o[k] = up(e, c) end
+		else
+			local p = ffi.cast(frptr, v)
+			local prec = C.mpfr_get_prec(p)
+			if C.mpfr_get_prec(o) ~= prec then C.mpfr_set_prec(o, prec) end
+			C.mpfr_set(o, p, 0) -- exact
+		end
+		return o
+	end
+	local t = type(v)
+	if t == 'userdata' then
+		local mt = getmetatable(v)
+		if mt == coremeta then
+			local p = ffi.cast(frptr, v)
+			local x = newprec(C.mpfr_get_prec(p))
+			C.mpfr_set(x, p, 0) -- exact
+			return x
+		elseif mt ~= zmeta and mt ~= fmeta then
+			local px = proxies[v]
+			if not px then px = setmetatable({ v }, pmeta); proxies[v] = px end
+			return px
+		end
+	elseif t == 'table' then
+		local copy = {}
+		for k, e in pairs(v) do copy[k] = up(e, c) end
+		return copy
+	end
+	return v
+end
+
+local forwarded = {}
+
+function forward(fn)
+	local g = forwarded[fn]
+	if not g then
+		g = function(...)
+			local c = {}
+			return mapall(up, c, fn(mapall(down, c, ...)))
+		end
+		forwarded[fn] = g
+	end
+	return g
+end
+
+pmeta.__index = function(px, k)
+	local v = px[1][k]
+	if type(v) == 'function' then return forward(v) end
+	return v
+end
+
+for _, e in ipairs { '__add', '__sub', '__mul', '__div', '__pow', '__unm',
+                     '__eq', '__lt', '__le', '__len', '__call', '__tostring',
+                     '__concat' } do
+	pmeta[e] = function(a, ...)
+		local obj = isproxy(a) and a[1] or (...)[1]
+		local mm = getmetatable(obj)[e]
+		if mm == nil then
+			error(("attempt to perform '%s' on an mpfr object"):format(e:sub(3)), 2)
+		end
+		return forward(mm)(a, ...)
+	end
+end
+
+local memo = { on = false }
+local threads = { n = 1, threshold = 1000000 }
+threads.n, threads.threshold = core.get_threads()
+
+-- whether any of the arguments is an mpfr value as big as set_threads says
+local function big(...)
+	for i = 1, select('#', ...) do
+		local v = select(i, ...)
+		if isfr(v) and C.mpfr_get_prec(v) >= threads.threshold then return true end
+	end
+	return false
+end
+
+-- Builds the table of functions sharing one default precision and rounding
+-- mode, which are those of MPFR itself when ctx is nil (see mpfr.context).
+
+local function bind(ctx)
+	local M = {}
+
+	local function checkrnd(r, i, fname)
+		if r == nil then
+			if ctx then return ctx.rnd end
+			return C.mpfr_get_default_rounding_mode()
+		end
+		local rnd = rnds[r]
+		if rnd == nil then
+			if type(r) ~= 'string' then typerror(i, fname, 'string', r) end
+			argerror(i, fname, 'invalid rounding mode')
+		end
+		return rnd
+	end
+
+	local function newfr()
+		return newprec(ctx and ctx.prec)
+	end
+
+	local function checkfr(v, i, fname)
+		if not isfr(v) then typerror(i, fname, 'mpfr', v) end
+		return v
+	end
+
+	local function checkfropt(v, i, fname)
+		if v == nil then return newfr() end
+		return checkfr(v, i, fname)
+	end
+
+	-- .1 Initialization functions
+
+	function M.fr(...)
+		local self = newfr()
+		return self, M.set(self, ...) -- FIXME misleading errors
+	end
+
+	function M.set_prec(self, prec)
+		checkfr(self, 1, 'set_prec')
+		C.mpfr_set_prec(self, checkprec(prec, 2, 'set_prec'))
+	end
+
+	function M.get_prec(self)
+		return tonumber(C.mpfr_get_prec(checkfr(self, 1, 'get_prec')))
+	end
+
+	-- .2 Assignment functions
+
+	local endp = ffi.new 'char *[1]'
+
+	function M.set(self, v, base, rnd)
+		if type(base) == 'string' and rnd == nil and v ~= nil then
+			base, rnd = nil, base
+		end
+		rnd = checkrnd(rnd, 3, 'set')
+		checkfr(self, 1, 'set')
+
+		local k = kind(v)
+		if k == FR then return C.mpfr_set(self, v, rnd)
+		elseif k == Z then return C.mpfr_set_z(self, toz(v), rnd)
+		elseif k == F then return C.mpfr_set_f(self, tof(v), rnd)
+		elseif k == UI then return C.mpfr_set_ui(self, v, rnd)
+		elseif k == SI then return C.mpfr_set_si(self, v, rnd)
+		elseif k == D then return C.mpfr_set_d(self, v, rnd)
+		elseif k == NIL then return
+		elseif k == STR then
+			if base ~= nil and (type(base) ~= 'number' or base ~= floor(base) or
+			                    base < 2 or base > 62) then
+				argerror(3, 'set', 'base out of range')
+			end
+			local ter = C.mpfr_strtofr(self, v, endp, base or 0, rnd)
+			local off = tonumber(endp[0] - ffi.cast('const char *', v))
+			if not v:find('^%s*$', off + 1) then
+				argerror(2, 'set', 'invalid floating-point constant')
+			end
+			return ter
+		end
+		typerror(2, 'set', 'mpfr, mpf, mpz, number, or string', v)
+	end
+
+	-- .4 Conversion functions
+
+	function M.get_d(self, rnd)
+		rnd = checkrnd(rnd, 2, 'get_d')
+		return C.mpfr_get_d(checkfr(self, 1, 'get_d'), rnd)
+	end
+
+	-- 64-bit results are boxed cdata so that they stay exact
+	function M.get_si(self, rnd)
+		rnd = checkrnd(rnd, 2, 'get_si')
+		return tonumber(C.mpfr_get_si(checkfr(self, 1, 'get_si'), rnd))
+	end
+
+	function M.get_ui(self, rnd)
+		rnd = checkrnd(rnd, 2, 'get_ui')
+		return tonumber(C.mpfr_get_ui(checkfr(self, 1, 'get_ui'), rnd))
+	end
+
+	function M.get_sj(self, rnd)
+		rnd = checkrnd(rnd, 2, 'get_sj')
+		return C.__gmpfr_mpfr_get_sj(checkfr(self, 1, 'get_sj'), rnd)
+	end
+
+	function M.get_uj(self, rnd)
+		rnd = checkrnd(rnd, 2, 'get_uj')
+		return C.__gmpfr_mpfr_get_uj(checkfr(self, 1, 'get_uj'), rnd)
+	end
+
+	local expp = ffi.new 'long[1]'
+
+	function M.get_d_2exp(self, rnd)
+		rnd = checkrnd(rnd, 2, 'get_d_2exp')
+		local d = C.mpfr_get_d_2exp(expp, checkfr(self, 1, 'get_d_2exp'), rnd)
+		return d, tonumber(expp[0])
+	end
+
+	local exptp = ffi.new 'mpfr_exp_t[1]'
+
+	function M.get_str(self, base, size, rnd)
+		if rnd == nil then
+			if type(size) == 'string' then size, rnd = nil, size
+			elseif size == nil and type(base) == 'string' then base, rnd = nil, base
+			end
+		end
+		rnd = checkrnd(rnd, 4, 'get_str')
+		checkfr(self, 1, 'get_str')
+		base = base or 10
+		if type(base) ~= 'number' or base ~= floor(base) or
+		   not (-36 <= base and base <= -2 or 2 <= base and base <= 62) then
+			argerror(2, 'get_str', 'base out of range')
+		end
+		if size ~= nil and (type(size) ~= 'number' or size ~= floor(size) or size < 1) then
+			argerror(3, 'get_str', 'size out of range')
+		end
+		local s = C.mpfr_get_str(nil, exptp, base, size or 0, self, rnd)
+		local str = ffi.string(s); C.mpfr_free_str(s)
+		return str, tonumber(exptp[0])
+	end
+
+	for _, t in ipairs { 'ulong', 'slong', 'uint', 'sint', 'ushort', 'sshort',
+	                     'uintmax', 'intmax' } do
+		local fname, f = 'fits_' .. t, C['mpfr_fits_' .. t .. '_p']
+		M[fname] = function(self, rnd)
+			rnd = checkrnd(rnd, 2, fname)
+			return f(checkfr(self, 1, fname), rnd) ~= 0
+		end
+	end
+
+	-- .5 Arithmetic functions
+
+	local function rest(res, rnd)
+		if type(res) == 'string' and rnd == nil then return nil, res end
+		return res, rnd
+	end
+
+	function M.add(a, b, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 4, 'add')
+		res = checkfropt(res, 3, 'add')
+		local j = 2
+		if not isfr(a) then
+			if not isfr(b) then error('bad arguments (neither is mpfr)', 2) end
+			a, b, j = b, a, 1
+		end
+		local k = kind(b)
+		if k == FR then return res, C.mpfr_add(res, a, b, rnd)
+		elseif k == Z then return res, C.mpfr_add_z(res, a, toz(b), rnd)
+		elseif k == UI then return res, C.mpfr_add_ui(res, a, b, rnd)
+		elseif k == SI then return res, C.mpfr_add_si(res, a, b, rnd)
+		elseif k == D then return res, C.mpfr_add_d(res, a, b, rnd)
+		end
+		typerror(j, 'add', 'mpfr, mpz, or number', b)
+	end
+
+	function M.sub(a, b, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 4, 'sub')
+		res = checkfropt(res, 3, 'sub')
+		local ka, kb = kind(a), kind(b)
+		if ka == FR then
+			if kb == FR then return res, C.mpfr_sub(res, a, b, rnd)
+			elseif kb == Z then return res, C.mpfr_sub_z(res, a, toz(b), rnd)
+			elseif kb == UI then return res, C.mpfr_sub_ui(res, a, b, rnd)
+			elseif kb == SI then return res, C.mpfr_sub_si(res, a, b, rnd)
+			elseif kb == D then return res, C.mpfr_sub_d(res, a, b, rnd)
+			end
+			typerror(2, 'sub', 'mpfr, mpz, or number', b)
+		elseif kb == FR then
+			if ka == Z then return res, C.mpfr_z_sub(res, toz(a), b, rnd)
+			elseif ka == UI then return res, C.mpfr_ui_sub(res, a, b, rnd)
+			elseif ka == SI then return res, C.mpfr_si_sub(res, a, b, rnd)
+			elseif ka == D then return res, C.mpfr_d_sub(res, a, b, rnd)
+			end
+			typerror(1, 'sub', 'mpfr, mpz, or number', a)
+		end
+		error('bad arguments (neither is mpfr)', 2)
+	end
+
+	function M.rsub(a, b, ...) return M.sub(b, a, ...) end
+
+	function M.mul(a, b, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 4, 'mul')
+		res = checkfropt(res, 3, 'mul')
+		local j = 2
+		if not isfr(a) then
+			if not isfr(b) then error('bad arguments (neither is mpfr)', 2) end
+			a, b, j = b, a, 1
+		end
+		local k = kind(b)
+		if k == FR then return res, C.mpfr_mul(res, a, b, rnd)
+		elseif k == Z then return res, C.mpfr_mul_z(res, a, toz(b), rnd)
+		elseif k == UI then return res, C.mpfr_mul_ui(res, a, b, rnd)
+		elseif k == SI then return res, C.mpfr_mul_si(res, a, b, rnd)
+		elseif k == D then return res, C.mpfr_mul_d(res, a, b, rnd)
+		end
+		typerror(j, 'mul', 'mpfr, mpz, or number', b)
+	end
+
+	function M.div(a, b, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 4, 'div')
+		res = checkfropt(res, 3, 'div')
+		local ka, kb = kind(a), kind(b)
+		if ka == FR then
+			if kb == FR then return res, C.mpfr_div(res, a, b, rnd)
+			elseif kb == Z then return res, C.mpfr_div_z(res, a, toz(b), rnd)
+			elseif kb == UI then return res, C.mpfr_div_ui(res, a, b, rnd)
+			elseif kb == SI then return res, C.mpfr_div_si(res, a, b, rnd)
+			elseif kb == D then return res, C.mpfr_div_d(res, a, b, rnd)
+			end
+			typerror(2, 'div', 'mpfr, mpz, or number', b)
+		elseif kb == FR then
+			if ka == UI then return res, C.mpfr_ui_div(res, a, b, rnd)
+			elseif ka == SI then return res, C.mpfr_si_div(res, a, b, rnd)
+			elseif ka == D then return res, C.mpfr_d_div(res, a, b, rnd)
+			end
+			typerror(1, 'div', 'mpfr or number', a)
+		end
+		error('bad arguments (neither is mpfr)', 2)
+	end
+
+	function M.rdiv(a, b, ...) return M.div(b, a, ...) end
+
+	for i = 1, #unary do
+		local fname, f = unary[i], C['mpfr_' .. unary[i]]
+		M[fname] = function(self, res, rnd)
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 3, fname)
+			checkfr(self, 1, fname)
+			res = checkfropt(res, 2, fname)
+			return res, f(res, self, rnd)
+		end
+	end
+
+	-- functions that also accept a non-negative integer argument
+	for fname, fui in pairs { sqrt = C.mpfr_sqrt_ui, log = C.mpfr_log_ui,
+	                          zeta = C.mpfr_zeta_ui } do
+		local f = M[fname]
+		M[fname] = function(self, res, rnd)
+			if isfr(self) then return f(self, res, rnd) end
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 3, fname)
+			res = checkfropt(res, 2, fname)
+			if kind(self) ~= UI then
+				typerror(1, fname, 'mpfr or non-negative integer', self)
+			end
+			return res, fui(res, self, rnd)
+		end
+	end
+
+	-- with memoization, these go through mpfr.core, which remembers
+	for _, fname in ipairs { 'gamma', 'lngamma', 'digamma', 'zeta' } do
+		local f, g = M[fname], forward(coremeta[fname])
+		M[fname] = function(self, res, rnd)
+			if not memo.on then return f(self, res, rnd) end
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 3, fname)
+			res = checkfropt(res, 2, fname)
+			return g(self, res, modes[rnd])
+		end
+	end
+
+	M.rsqrt = M.rec_sqrt
+	M.tgamma = M.gamma
+
+	function M.rootn(self, n, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 4, 'rootn')
+		checkfr(self, 1, 'rootn')
+		res = checkfropt(res, 3, 'rootn')
+		if type(n) ~= 'number' or n ~= floor(n) or n < 0 or n >= ULONG_LIM then
+			argerror(2, 'rootn', 'root degree out of range')
+		end
+		return res, C.mpfr_rootn_ui(res, self, n, rnd)
+	end
+
+	local function exp2fn(fname, fui, fsi)
+		return function(self, n, res, rnd)
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 4, fname)
+			checkfr(self, 1, fname)
+			res = checkfropt(res, 3, fname)
+			if type(n) ~= 'number' or n ~= floor(n) then
+				typerror(2, fname, 'integer', n)
+			end
+			if 0 <= n and n < ULONG_LIM then return res, fui(res, self, n, rnd) end
+			if -LONG_LIM <= n and n < LONG_LIM then return res, fsi(res, self, n, rnd) end
+			argerror(2, fname, 'exponent out of range')
+		end
+	end
+
+	M.mul_2exp = exp2fn('mul_2exp', C.mpfr_mul_2ui, C.mpfr_mul_2si)
+	M.div_2exp = exp2fn('div_2exp', C.mpfr_div_2ui, C.mpfr_div_2si)
+
+	-- .6 Comparison functions
+
+	-- unlike the C version, propagates NaNs to output
+	function M.cmp(a, b)
+		local j = 2
+		if not isfr(a) then
+			if not isfr(b) then error('bad arguments (neither is mpfr)', 2) end
+			a, b, j = b, a, 1
+		end
+		local k, res = kind(b)
+		if k == FR then res = C.mpfr_cmp(a, b)
+		elseif k == Z then res = C.mpfr_cmp_z(a, toz(b))
+		elseif k == F then res = C.mpfr_cmp_f(a, tof(b))
+		elseif k == UI then res = C.mpfr_cmp_ui(a, b)
+		elseif k == SI then res = C.mpfr_cmp_si(a, b)
+		elseif k == D then res = C.mpfr_cmp_d(a, b)
+		else typerror(j, 'cmp', 'mpfr, mpz, mpf, or number', b)
+		end
+		if C.mpfr_erangeflag_p() ~= 0 then
+			if C.mpfr_nan_p(a) ~= 0 then return a end
+			if k == FR and C.mpfr_nan_p(b) ~= 0 then return b end
+		end
+		return res
+	end
+
+	for _, p in ipairs { 'nan', 'inf', 'number', 'zero', 'regular', 'integer' } do
+		local f = C['mpfr_' .. p .. '_p']
+		M[p] = function(self) return f(checkfr(self, 1, p)) ~= 0 end
+	end
+
+	-- also propagates NaNs
+	function M.sgn(self)
+		local res = C.mpfr_sgn(checkfr(self, 1, 'sgn'))
+		if C.mpfr_erangeflag_p() ~= 0 and C.mpfr_nan_p(self) ~= 0 then
+			return self
+		end
+		return res
+	end
+
+	for fname, p in pairs { lt = 'less', le = 'lessequal', eq = 'equal',
+	                        ge = 'greaterequal', gt = 'greater' } do
+		local f = C['mpfr_' .. p .. '_p']
+		M[fname] = function(a, b)
+			return f(checkfr(a, 1, fname), checkfr(b, 2, fname)) ~= 0
+		end
+	end
+
+	-- .7 Transcendental functions
+
+	function M.pow(a, b, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 4, 'pow')
+		res = checkfropt(res, 3, 'pow')
+		local ka, kb = kind(a), kind(b)
+		if ka == FR then
+			if kb == FR then return res, C.mpfr_pow(res, a, b, rnd)
+			elseif kb == Z then return res, C.mpfr_pow_z(res, a, toz(b), rnd)
+			elseif kb == UI then return res, C.mpfr_pow_ui(res, a, b, rnd)
+			elseif kb == SI then return res, C.mpfr_pow_si(res, a, b, rnd)
+			end
+			typerror(2, 'pow', 'mpfr, mpz, or integer', b)
+		elseif kb == FR then
+			if ka == UI then return res, C.mpfr_ui_pow(res, a, b, rnd) end
+			typerror(1, 'pow', 'mpfr or non-negative integer', a)
+		elseif ka == UI and kb == UI then
+			return res, C.mpfr_ui_pow_ui(res, a, b, rnd)
+		end
+		error('bad arguments (neither is mpfr)', 2)
+	end
+
+	function M.rpow(a, b, ...) return M.pow(b, a, ...) end
+
+	for fname, f in pairs { sin_cos = C.mpfr_sin_cos, sinh_cosh = C.mpfr_sinh_cosh } do
+		M[fname] = function(self, r1, r2, rnd)
+			if rnd == nil then
+				if type(r2) == 'string' then r2, rnd = nil, r2
+				elseif r2 == nil and type(r1) == 'string' then r1, rnd = nil, r1
+				end
+			end
+			rnd = checkrnd(rnd, 4, fname)
+			checkfr(self, 1, fname)
+			r1 = checkfropt(r1, 2, fname); r2 = checkfropt(r2, 3, fname)
+			return r1, r2, f(r1, r2, self, rnd)
+		end
+	end
+	M.sincos, M.sincosh = M.sin_cos, M.sinh_cosh
+
+	for i = 1, #binary do
+		local fname, f = binary[i], C['mpfr_' .. binary[i]]
+		M[fname] = function(a, b, res, rnd)
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 4, fname)
+			checkfr(a, 1, fname); checkfr(b, 2, fname)
+			res = checkfropt(res, 3, fname)
+			return res, f(res, a, b, rnd)
+		end
+	end
+
+	local signp = ffi.new 'int[1]'
+
+	function M.lgamma(self, res, rnd)
+		res, rnd = rest(res, rnd)
+		rnd = checkrnd(rnd, 3, 'lgamma')
+		checkfr(self, 1, 'lgamma')
+		res = checkfropt(res, 2, 'lgamma')
+		local ter = C.mpfr_lgamma(res, signp, self, rnd)
+		return res, signp[0], ter
+	end
+
+	for fname, f in pairs { jn = C.mpfr_jn, yn = C.mpfr_yn } do
+		M[fname] = function(a, b, res, rnd)
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 4, fname)
+			local self, n, nidx = a, b, 2
+			if not isfr(a) then self, n, nidx = b, a, 1 end
+			if type(n) ~= 'number' or n ~= floor(n) then
+				typerror(nidx, fname, 'integer', n)
+			end
+			checkfr(self, 3 - nidx, fname)
+			res = checkfropt(res, 3, fname)
+			if n < -LONG_LIM or n >= LONG_LIM then
+				argerror(nidx, fname, 'index out of range')
+			end
+			return res, f(res, n, self, rnd)
+		end
+	end
+
+	for _, fname in ipairs { 'jn', 'yn' } do
+		local f, g = M[fname], forward(coremeta[fname])
+		M[fname] = function(a, b, res, rnd)
+			if not memo.on then return f(a, b, res, rnd) end
+			res, rnd = rest(res, rnd)
+			rnd = checkrnd(rnd, 4, fname)
+			res = checkfropt(res, 3, fname)
+			return g(a, b, res, modes[rnd])
+		end
+	end
+
+	-- with threads, big products, quotients and square roots go through
+	-- mpfr.core, which splits them
+	for fname, n in pairs { mul = 2, div = 2, sqrt = 1 } do
+		local f, g = M[fname], forward(coremeta[fname])
+		M[fname] = function(...)
+			if threads.n == 1 or not big(...) then return f(...) end
+			local args = { ... }
+			local res, rnd = rest(args[n + 1], args[n + 2])
+			args[n + 2] = modes[checkrnd(rnd, n + 2, fname)]
+			args[n + 1] = checkfropt(res, n + 1, fname)
+			return g(unpack(args, 1, n + 2))
+		end
+	end
+
+	-- .9 Formatted output functions
+
+	local strp = ffi.new 'char *[1]'
+	local int = ffi.typeof 'int'
+
+	function M.format(self, spec, ...)
+		checkfr(self, 1, 'format')
+		if type(spec) ~= 'string' then typerror(2, 'format', 'string', spec) end
+		local args, idx = { ... }, 0
+		local function nextint(what)
+			idx = idx + 1
+			local n = args[idx]
+			if type(n) ~= 'number' or n ~= floor(n) or n < 0 or n > 2^31 - 1 then
+				argerror(idx + 2, 'format', what .. ' out of range')
+			end
+			return n
+		end
+
+		local flags, width, dot, prec, r, conv = spec:match
+			'^%%?([0= +]*)(%*?%d*)(%.?)(%*?%d*)R?([UDYZNF*]?)(.*)$'
+		if not flags then argerror(2, 'format', 'invalid format specification') end
+		local fmt = { '%', flags }
+		local w, p = nil, nil
+		if width == '*' then w = nextint 'width'; fmt[#fmt + 1] = '*'
+		elseif width:find '^%d*$' then fmt[#fmt + 1] = width
+		else argerror(2, 'format', 'invalid format specification')
+		end
+		if dot == '.' then
+			fmt[#fmt + 1] = '.'
+			if prec == '*' then p = nextint 'precision'; fmt[#fmt + 1] = '*'
+			elseif prec:find '^%d*$' then fmt[#fmt + 1] = prec
+			else argerror(2, 'format', 'invalid format specification')
+			end
+		elseif prec ~= '' then
+			argerror(2, 'format', 'invalid format specification')
+		end
+		local rnd
+		if r ~= '' and r ~= '*' then rnd = opts[r]
+		else idx = idx + 1; rnd = checkrnd(args[idx], idx + 2, 'format')
+		end
+		if not conv:find '^[AabEeFfGg]$' then
+			argerror(2, 'format', 'invalid format specification')
+		end
+		fmt[#fmt + 1] = 'R*'; fmt[#fmt + 1] = conv
+		fmt = table.concat(fmt)
+
+		if w and p then C.mpfr_asprintf(strp, fmt, int(w), int(p), int(rnd), self)
+		elseif w then C.mpfr_asprintf(strp, fmt, int(w), int(rnd), self)
+		elseif p then C.mpfr_asprintf(strp, fmt, int(p), int(rnd), self)
+		else C.mpfr_asprintf(strp, fmt, int(rnd), self)
+		end
+		local s = ffi.string(strp[0]); C.mpfr_free_str(strp[0])
+		return s
+	end
+
+	-- .10 Integer and remainder related functions
+
+	for _, fname in ipairs { 'ceil', 'floor', 'round', 'roundeven', 'trunc' } do
+		local f = C['mpfr_' .. fname]
+		M[fname] = function(self, res)
+			checkfr(self, 1, fname)
+			res = checkfropt(res, 2, fname)
+			return res, f(res, self)
+		end
+	end
+
+	-- .11 Rounding-related functions
+
+	function M.prec_round(self, prec, rnd)
+		rnd = checkrnd(rnd, 3, 'prec_round')
+		checkfr(self, 1, 'prec_round')
+		return C.mpfr_prec_round(self, checkprec(prec, 2, 'prec_round'), rnd)
+	end
+
+	return M
+end
+
+local met = bind(nil)
+
+gc.__index = met
+-- with a complex number on the right, as complex numbers
+for e, f in pairs { __add = met.add, __sub = met.sub, __mul = met.mul,
+                    __div = met.div } do
+	local pm = pmeta[e]
+	gc[e] = function(a, b)
+		if isproxy(b) then return pm(a, b) end
+		return (f(a, b))
+	end
+end
+gc.__pow = met.pow
+gc.__unm = function(self) return (met.neg(self)) end
+gc.__lt  = met.lt
+gc.__le  = met.le
+gc.__eq  = function(a, b) return isfr(a) and isfr(b) and met.eq(a, b) end
+gc.__tostring = function(self) return met.format(self, 'g') end
+gc.__concat = function(a, b)
+	if isfr(a) then return met.format(a, 'g') .. b end
+	return a .. met.format(b, 'g')
+end
+ffi.metatype(frct, gc)
+
+local mod = {
+	fr = met.fr,
+	sqrt = met.sqrt, log = met.log, pow = met.pow, atan2 = met.atan2,
+	beta = met.beta, zeta = met.zeta, jn = met.jn, yn = met.yn, agm = met.agm,
+}
+
+-- the fields are checked here so that errors name them, as in mpfr.c
+function mod.context(opts)
+	if type(opts) ~= 'table' then typerror(1, 'context', 'table', opts) end
+	local prec, rnd = opts.prec, opts.rnd
+	if prec == nil then
+		prec = tonumber(C.mpfr_get_default_prec())
+	else
+		prec = tonumber(prec)
+		if prec == nil then argerror(1, 'context', "field 'prec' is not a number") end
+		if prec ~= floor(prec) or prec < 1 or prec > PREC_MAX then
+			argerror(1, 'context', "field 'prec' out of range")
+		end
+	end
+	if rnd == nil then
+		rnd = C.mpfr_get_default_rounding_mode()
+	else
+		rnd = type(rnd) == 'string' and rnds[rnd]
+		if not rnd then argerror(1, 'context', "field 'rnd' is not a valid rounding mode") end
+	end
+	return bind { prec = prec, rnd = rnd }
+end
+
+function mod.set_default_prec(prec)
+	C.mpfr_set_default_prec(checkprec(prec, 1, 'set_default_prec'))
+end
+
+function mod.get_default_prec()
+	return tonumber(C.mpfr_get_default_prec())
+end
+
+function mod.set_default_rounding_mode(rnd)
+	local r = rnds[rnd]
+	if r == nil then argerror(1, 'set_default_rounding_mode', 'invalid rounding mode') end
+	C.mpfr_set_default_rounding_mode(r)
+end
+
+function mod.get_default_rounding_mode()
+	return modes[C.mpfr_get_default_rounding_mode()]
+end
+
+-- Bulk conversion, packed strings as in string.pack 'd' and 'j'
+
+local dptr = ffi.typeof 'const double *'
+local jptr = ffi.typeof 'const int64_t *'
+
+local function modrnd(r, i, fname)
+	if r == nil then return C.mpfr_get_default_rounding_mode() end
+	local rnd = rnds[r]
+	if rnd == nil then argerror(i, fname, 'invalid rounding mode') end
+	return rnd
+end
+
+function mod.from_numbers(src, prec, rnd, fmt)
+	if prec ~= nil then checkprec(prec, 2, 'from_numbers') end
+	rnd = modrnd(rnd, 3, 'from_numbers')
+	if fmt ~= nil and fmt ~= 'd' and fmt ~= 'j' then
+		argerror(4, 'from_numbers', ("invalid option '%s'"):format(fmt))
+	end
+
+	local res, n, buf = {}
+	if type(src) == 'string' then
+		if #src % 8 ~= 0 then argerror(1, 'from_numbers', 'length not a multiple of 8') end
+		n, buf = #src / 8, ffi.cast(fmt == 'j' and jptr or dptr, src)
+	elseif type(src) == 'table' then
+		n = #src
+	else
+		typerror(1, 'from_numbers', 'table or string', src)
+	end
+	for i = 1, n do
+		local p = newprec(prec)
+		if buf then
+			if fmt == 'j' then C.__gmpfr_set_sj(p, buf[i - 1], rnd)
+			else C.mpfr_set_d(p, buf[i - 1], rnd) end
+		else
+			local v = src[i]
+			local k = kind(v)
+			if k == FR then C.mpfr_set(p, v, rnd)
+			elseif k == Z then C.mpfr_set_z(p, toz(v), rnd)
+			elseif k == F then C.mpfr_set_f(p, tof(v), rnd)
+			elseif k == UI then C.mpfr_set_ui(p, v, rnd)
+			elseif k == SI then C.mpfr_set_si(p, v, rnd)
+			elseif k == D then C.mpfr_set_d(p, v, rnd)
+			else
+				error(("bad element #%d (number expected, got %s)"):format(i, type(v)), 2)
+			end
+		end
+		res[i] = p
+	end
+	return res
+end
+
+local layouts = { table = true, packed = true, d = true, j = true }
+
+function mod.to_numbers(t, rnd, layout)
+	if type(t) ~= 'table' then typerror(1, 'to_numbers', 'table', t) end
+	rnd = modrnd(rnd, 2, 'to_numbers')
+	layout = layout or 'table'
+	if not layouts[layout] then
+		argerror(3, 'to_numbers', ("invalid option '%s'"):format(layout))
+	end
+
+	local n = #t
+	local res = layout == 'table' and {} or
+	            ffi.new(layout == 'j' and 'int64_t[?]' or 'double[?]', n)
+	for i = 1, n do
+		local v = t[i]
+		if not isfr(v) then
+			error(("bad element #%d (mpfr expected, got %s)"):format(i, type(v)), 2)
+		end
+		if layout == 'table' then res[i] = C.mpfr_get_d(v, rnd)
+		elseif layout == 'j' then res[i - 1] = C.__gmpfr_mpfr_get_sj(v, rnd)
+		else res[i - 1] = C.mpfr_get_d(v, rnd) end
+	end
+	if layout == 'table' then return res end
+	return ffi.string(res, 8 * n)
+end
+
+-- Sorting and searching, with NaNs last as in mpfr.c
+
+local function ordcmp(a, b)
+	if C.mpfr_nan_p(a) ~= 0 then return C.mpfr_nan_p(b) == 0 and 1 or 0 end
+	if C.mpfr_nan_p(b) ~= 0 then return -1 end
+	return C.mpfr_cmp(a, b)
+end
+
+local function checkelems(t, fname)
+	if type(t) ~= 'table' then typerror(1, fname, 'table', t) end
+	for i = 1, #t do
+		if not isfr(t[i]) then
+			error(("bad element #%d (mpfr expected, got %s)"):format(i, type(t[i])), 3)
+		end
+	end
+	return #t
+end
+
+local function order(t, desc, fname)
+	local idx = {}
+	for i = 1, checkelems(t, fname) do idx[i] = i end
+	table.sort(idx, function(i, j)
+		local a, b, c = t[i], t[j]
+		if desc and C.mpfr_nan_p(a) == 0 and C.mpfr_nan_p(b) == 0 then
+			c = C.mpfr_cmp(b, a)
+		else
+			c = ordcmp(a, b)
+		end
+		if c ~= 0 then return c < 0 end
+		return i < j
+	end)
+	return idx
+end
+
+function mod.sort(t, desc)
+	local idx, copy = order(t, desc, 'sort'), {}
+	for i = 1, #idx do copy[i] = t[idx[i]] end
+	for i = 1, #copy do t[i] = copy[i] end
+	return t
+end
+
+function mod.argsort(t, desc)
+	return order(t, desc, 'argsort')
+end
+
+function mod.minmax(t)
+	local imin, imax
+	for i = 1, checkelems(t, 'minmax') do
+		local v = t[i]
+		if C.mpfr_nan_p(v) == 0 then
+			if not imin or C.mpfr_less_p(v, t[imin]) ~= 0 then imin = i end
+			if not imax or C.mpfr_greater_p(v, t[imax]) ~= 0 then imax = i end
+		end
+	end
+	if imin then return t[imin], t[imax], imin, imax end
+end
+
+function mod.searchsorted(t, x, side)
+	if type(t) ~= 'table' then typerror(1, 'searchsorted', 'table', t) end
+	if side ~= nil and side ~= 'left' and side ~= 'right' then
+		argerror(3, 'searchsorted', ("invalid option '%s'"):format(side))
+	end
+	if type(x) == 'number' then
+		local tmp = newprec(64)
+		C.mpfr_set_d(tmp, x, 0) -- exact
+		x = tmp
+	elseif not isfr(x) then
+		typerror(2, 'searchsorted', 'mpfr or number', x)
+	end
+
+	local lo, hi = 1, #t + 1
+	while lo < hi do
+		local mid = floor((lo + hi) / 2)
+		local v = t[mid]
+		if not isfr(v) then
+			error(("bad element #%d (mpfr expected, got %s)"):format(mid, type(v)), 2)
+		end
+		local c = ordcmp(v, x)
+		if c < 0 or side == 'right' and c == 0 then lo = mid + 1 else hi = mid end
+	end
+	return lo
+end
+
+-- The rest is forwarded to mpfr.core
+
+for _, fname in ipairs { 'integrate', 'newton', 'invert', 'memo_stats',
+                         'memo_flush', 'get_threads', 'cumsum', 'cumprod',
+                         'approximate', 'complex' } do
+	mod[fname] = forward(core[fname])
+end
+
+function mod.memoize(n)
+	core.memoize(n)
+	memo.on = n > 0
+end
+
+function mod.set_threads(n, threshold)
+	core.set_threads(n, threshold)
+	threads.n, threads.threshold = core.get_threads()
+end
+
+return mod
@@ -0,0 +1,48 @@
+-- Tests for mpfr.approximate, run as `lua test/approximate.lua` with the
+-- module on package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- interpolated, within the estimate
+
+do
+	local ap = mpfr.approximate('erf', -2, 2, 64)
+	local c64 = mpfr.context {prec = 64}
+	local err, nexact, npiece = ap:estimate()
+	check(npiece >= 1 and err:get_d() < 2 ^ -64, 'approximate estimate')
+	for _, x in ipairs {-1.75, -0.3, 0, 0.5, 1.9} do
+		local y, z = ap(x), (c64.erf((c64.fr(x))))
+		check(math.abs((y - z):get_d()) <= err:get_d() + 2 ^ -63, 'approximate erf')
+	end
+	local ys = ap:evalv {0.25, fr(1)}
+	check(ys[1] == ap(0.25) and ys[2] == ap(fr(1)), 'approximate evalv')
+end
+
+-- falling back to the function
+
+do
+	local c = mpfr.context {prec = 64}
+	local ap = mpfr.approximate('gamma', -3, 3, 64)
+	local _, nexact = ap:estimate()
+	check(nexact >= 1, 'pieces around poles fall back')
+	check(ap(7) == (c.gamma((c.fr(7)))), 'arguments outside the interval')
+end
+
+do
+	-- exp is so cheap at 1000 bits that the interpolant does not pay off
+	local c = mpfr.context {prec = 1000}
+	local ap = mpfr.approximate('exp', -3, 3, 1000)
+	local err, nexact, npiece = ap:estimate()
+	check(nexact == npiece and err:zero(), 'exp falls back everywhere')
+	for _, rnd in ipairs {'N', 'Z', 'U', 'D'} do
+		local x = (c.div((c.fr(1)), 3))
+		check(ap(x, nil, rnd) == (c.exp(x, nil, rnd)), 'exp correctly rounded')
+	end
+end
+
+print 'ok'
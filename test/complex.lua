@@ -0,0 +1,40 @@
+-- Tests for mpfr.complex, run as `lua test/complex.lua` with the module on
+-- package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+local z = mpfr.complex(1, 2)
+local w = z:mul(z)
+check(w:re() == fr(-3) and w:im() == fr(4), 'complex mul')
+check(mpfr.complex(1, 'N'):re() == fr(1), 'complex with a rounding mode')
+check(z == mpfr.complex(1, 2) and z + 1 == mpfr.complex(2, 2), 'complex operators')
+w = mpfr.complex(-4):sqrt()
+check(w:re():zero() and w:im() == fr(2), 'exact square root')
+w = fr(1) + z
+check(w:re() == fr(2) and w:im() == fr(2), 'mpfr + complex')
+w = fr(1) / mpfr.complex(0, 1)
+check(w:re() == fr(0) and w:im() == fr(-1), 'mpfr / complex')
+
+-- correctly rounded, with the right ternary values: exp(1 + i) against
+-- e cos 1 and e sin 1 at 300 bits
+local c300 = mpfr.context {prec = 300}
+local e = (c300.exp((c300.fr(1))))
+local exact = {(c300.mul(e, (c300.cos((c300.fr(1)))))),
+               (c300.mul(e, (c300.sin((c300.fr(1))))))}
+for _, rnd in ipairs {'N', 'Z', 'U', 'D'} do
+	local r, tre, tim = mpfr.complex(1, 1):exp(nil, rnd)
+	local parts, t = {r:re(), r:im()}, {tre, tim}
+	for i = 1, 2 do
+		local x = fr(0); x:set(exact[i], rnd)
+		check(parts[i] == x, 'correctly rounded exp, rounding ' .. rnd)
+		local d = (c300.sub(parts[i], exact[i]))
+		check(t[i] ~= 0 and (t[i] < 0) == (d < fr(0)), 'ternary value, rounding ' .. rnd)
+	end
+end
+
+print 'ok'
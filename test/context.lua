@@ -0,0 +1,30 @@
+-- Tests for mpfr.context, run as `lua test/context.lua` with the module on
+-- package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- whether f(...) raises an error containing all the strings in pats
+local function fails(pats, f, ...)
+	local ok, err = pcall(f, ...)
+	if ok then return false end
+	for _, pat in ipairs(pats) do
+		if not tostring(err):find(pat, 1, true) then return false end
+	end
+	return true
+end
+
+local ctx = mpfr.context {prec = 100, rnd = 'D'}
+check(ctx.fr(2):get_prec() == 100, 'context precision')
+check(select(2, ctx.sqrt((ctx.fr(2)))) < 0, 'context rounding mode')
+check(select(2, mpfr.context({prec = 100, rnd = 'U'}).sqrt((ctx.fr(2)))) > 0,
+      'context rounding up')
+check(fails({'bad argument #1', "(field 'prec'"}, mpfr.context, {prec = 0}),
+      'context reports prec against argument #1')
+check(fails({'bad argument #1', "(field 'rnd'"}, mpfr.context, {rnd = 'Q'}),
+      'context reports rnd against argument #1')
+
+print 'ok'
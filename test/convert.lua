@@ -0,0 +1,52 @@
+-- Tests for the exact integer getters, mpfr.from_numbers and
+-- mpfr.to_numbers, run as `lua test/convert.lua` with the module on
+-- package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- whether f(...) raises an error containing all the strings in pats
+local function fails(pats, f, ...)
+	local ok, err = pcall(f, ...)
+	if ok then return false end
+	for _, pat in ipairs(pats) do
+		if not tostring(err):find(pat, 1, true) then return false end
+	end
+	return true
+end
+
+-- exact integer getters
+
+check(fr(2 ^ 40):get_si() == 2 ^ 40, 'get_si')
+check(fr(-3.75):get_si('Z') == -3, 'get_si rounding')
+check(fr(-3.75):get_si('D') == -4, 'get_si rounding down')
+check(fr(-1):get_ui() == 0, 'get_ui saturates')
+
+-- bulk conversion
+
+local t = mpfr.from_numbers {1, 2.5, fr(3)}
+local u = mpfr.to_numbers(t)
+check(#t == 3 and u[1] == 1 and u[2] == 2.5 and u[3] == 3, 'from/to_numbers')
+t = mpfr.from_numbers({1 / 3}, 10, 'U')
+check(t[1]:get_prec() == 10 and t[1] > fr(1 / 3), 'from_numbers precision and rounding')
+local c100 = mpfr.context {prec = 100}
+local third = (c100.div((c100.fr(1)), 3))
+check(mpfr.to_numbers({third}, 'D')[1] < mpfr.to_numbers({third}, 'U')[1],
+      'to_numbers rounding')
+check(fails({'bad element #1'}, mpfr.from_numbers, {'1'}), 'from_numbers rejects strings')
+if string.pack then
+	t = mpfr.from_numbers(string.pack('=dd', 0.5, -2))
+	check(t[1] == fr(0.5) and t[2] == fr(-2), 'from_numbers packed')
+	check(mpfr.to_numbers(t, nil, 'packed') == string.pack('=dd', 0.5, -2),
+	      'to_numbers packed')
+	t = mpfr.from_numbers(string.pack('=jj', 2 ^ 53 + 1, -7), 64, nil, 'j')
+	check(t[1]:get_sj() == 2 ^ 53 + 1 and t[2] == fr(-7), 'from_numbers packed integers')
+	check(mpfr.to_numbers(t, nil, 'j') == string.pack('=jj', 2 ^ 53 + 1, -7),
+	      'to_numbers packed integers')
+end
+
+print 'ok'
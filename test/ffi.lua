@@ -0,0 +1,83 @@
+-- Tests for mpfr.ffi, run as `luajit test/ffi.lua` with the module on
+-- package.cpath and package.path (e.g. after `luarocks make`).  Elsewhere
+-- only that mpfr is mpfr.core is checked.
+
+if not jit then
+	assert(require 'mpfr' == require 'mpfr.core', 'failed: mpfr is mpfr.core')
+	print 'skipped' return
+end
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- whether f(...) raises an error containing all the strings in pats
+local function fails(pats, f, ...)
+	local ok, err = pcall(f, ...)
+	if ok then return false end
+	for _, pat in ipairs(pats) do
+		if not tostring(err):find(pat, 1, true) then return false end
+	end
+	return true
+end
+
+-- selected automatically
+
+check(mpfr == require 'mpfr.ffi', 'mpfr is mpfr.ffi')
+check(type(fr(1)) == 'cdata', 'values are cdata')
+
+-- implemented directly
+
+local t = mpfr.from_numbers {3, 1, 2}
+mpfr.sort(t)
+check(mpfr.searchsorted(t, 2.5) == 3, 'searchsorted')
+check(mpfr.context {prec = 80}.fr(1):get_prec() == 80, 'context')
+check(fails({'#1', "field 'prec'"}, mpfr.context, {prec = 0}), 'context with a bad prec')
+check(fails({'#1', "field 'prec'"}, mpfr.context, {prec = 'x'}),
+      'context with a non-numeric prec')
+check(fails({'#1', "field 'rnd'"}, mpfr.context, {rnd = 'Q'}), 'context with a bad rnd')
+
+-- forwarded to mpfr.core
+
+local v = mpfr.integrate(function (x) return x * x end, 0, 1)
+check(type(v) == 'cdata' and (v - fr(1) / 3):abs() < fr(1e-15), 'integrate')
+
+local s = mpfr.cumsum {1, fr(2), 3}
+check(type(s[3]) == 'cdata' and s[3] == fr(6), 'cumsum')
+check(mpfr.cumprod({2, 3})[2] == fr(6), 'cumprod')
+
+local x = mpfr.newton(function (y) return y * y - 2 end,
+                     function (y) return 2 * y end, 1.5)
+check(type(x) == 'cdata' and (x - fr(2):sqrt()):abs() < fr(1e-15), 'newton')
+
+local ap = mpfr.approximate('exp', 0, 1, 53)
+check(((ap(0.5)) - fr(0.5):exp()):abs() < fr(1e-14), 'approximate')
+
+local z = mpfr.complex(1, 2)
+local w = z * z
+check(w:re() == fr(-3) and w:im() == fr(4), 'complex arithmetic')
+check((fr(1) + z):re() == fr(2), 'mpfr value plus complex')
+
+local res = fr(0)
+mpfr.memoize(16)
+fr(5):gamma(res)
+check(res == fr(24), 'memoized gamma into a result')
+check(mpfr.memo_stats() ~= nil, 'memo_stats')
+mpfr.memoize(0)
+
+local n0, t0 = mpfr.get_threads()
+mpfr.set_threads(4, 1)
+for _, rnd in ipairs {'N', 'Z', 'U', 'D'} do
+	local a, b = fr(1) / 3, fr(7)
+	local q1, t1 = a:div(b, rnd)
+	mpfr.set_threads(1)
+	local q2, t2 = a:div(b, rnd)
+	mpfr.set_threads(4, 1)
+	check(q1 == q2 and t1 == t2, 'threaded div')
+end
+mpfr.set_threads(n0, t0)
+
+print 'ok'
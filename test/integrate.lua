@@ -0,0 +1,79 @@
+-- Tests for mpfr.integrate, run as `lua test/integrate.lua` with the module
+-- on package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- whether f(...) raises an error containing all the strings in pats
+local function fails(pats, f, ...)
+	local ok, err = pcall(f, ...)
+	if ok then return false end
+	for _, pat in ipairs(pats) do
+		if not tostring(err):find(pat, 1, true) then return false end
+	end
+	return true
+end
+
+local function sq(x) return x * x end
+
+-- options
+
+check(fails({'#4', "field 'prec'"}, mpfr.integrate, sq, 0, 1, {prec = 'x'}),
+      'integrate with a non-numeric prec')
+check(fails({'#4', "field 'prec'"}, mpfr.integrate, sq, 0, 1, {prec = 0}),
+      'integrate with a bad prec')
+check(fails({'#4', "field 'method'"}, mpfr.integrate, sq, 0, 1, {method = 'simpson'}),
+      'integrate with a bad method')
+check(fails({'#4', "field 'rnd'"}, mpfr.integrate, sq, 0, 1, {rnd = 'Q'}),
+      'integrate with a bad rnd')
+check(mpfr.integrate(sq, 0, 1, {prec = 100}):get_prec() == 100, 'integrate prec')
+do
+	local up = mpfr.integrate(sq, 0, 1, {rnd = 'U'})
+	local down = mpfr.integrate(sq, 0, 1, {rnd = 'D'})
+	check(up > down and up:get_d() == down:get_d() + 2 ^ -54, 'integrate rnd')
+end
+
+-- the error estimate holds, also for endpoint singularities
+
+do
+	local pi = 4 * fr(1):atan()
+	local v, e = mpfr.integrate(function(x) return 1 / mpfr.sqrt(1 - x * x) end,
+	                            0, 1, {prec = 64})
+	check(v:number() and e:number(), 'integrate skips the singular endpoints')
+	check(math.abs((v - pi / 2):get_d()) <= math.max(e:get_d(), 1e-15),
+	      'integrate of 1/sqrt(1 - x^2)')
+	v = mpfr.integrate(sq, 0, 1, {prec = 64, method = 'gauss-legendre'})
+	check(math.abs(v:get_d() - 1 / 3) < 1e-15, 'gauss-legendre of x^2')
+end
+
+for _, m in ipairs {'tanh-sinh', 'gauss-legendre'} do
+	for k, exact in pairs {[0.5] = 2, [0.9] = 10, [0.99] = 100} do
+		local v, e = mpfr.integrate(function(x) return x:pow((fr(-k))) end, 0, 1,
+		                            {method = m})
+		check(math.abs(v:get_d() - exact) <= e:get_d(),
+		      'estimate for x^-' .. k .. ' by ' .. m)
+	end
+end
+
+-- no convergence
+
+do
+	local v, e = mpfr.integrate(function() return 1 / 0 end, 0, 1)
+	check(e:inf(), 'integrate of inf has an infinite error estimate')
+	for _, m in ipairs {'tanh-sinh', 'gauss-legendre'} do
+		for _, f in ipairs {
+			function(x) return 1 / x end,
+			function(x) return 1 / (x * x) end,
+			function(x) return x:pow((fr(-1.01))) end,
+		} do
+			v, e = mpfr.integrate(f, 0, 1, {method = m})
+			check(e:inf(), 'divergent integral by ' .. m)
+		end
+	end
+end
+
+print 'ok'
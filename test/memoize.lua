@@ -0,0 +1,43 @@
+-- Tests for mpfr.memoize, run as `lua test/memoize.lua` with the module on
+-- package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+local function isint(v)
+	return math.type == nil or math.type(v) == 'integer'
+end
+
+mpfr.memoize(4)
+local a = fr(3.5):gamma()
+local b = fr(3.5):gamma()
+local hits, misses, count = mpfr.memo_stats()
+check(a == b and hits == 1 and misses == 1 and count == 1, 'memoize')
+check(isint(hits) and isint(misses), 'memo_stats returns integers')
+
+-- the precision of the argument does not matter, that of the result does
+local x = fr(3.5); x:set_prec(200); x:set(3.5)
+check(x:gamma() == a and select(1, mpfr.memo_stats()) == 2, 'argument precision')
+local c = mpfr.context {prec = 100}
+check(c.gamma((c.fr(3.5))):get_prec() == 100 and select(3, mpfr.memo_stats()) == 2,
+      'result precision')
+
+-- the ternary value of a remembered result
+local t1 = select(2, fr(0.1):zeta())
+local t2 = select(2, fr(0.1):zeta())
+check(t1 == t2 and t1 ~= 0, 'ternary value of a remembered result')
+
+-- the least recently used is forgotten first
+mpfr.memoize(1)
+fr(2.5):gamma(); fr(1.5):gamma(); fr(2.5):gamma()
+hits, misses, count = mpfr.memo_stats()
+check(hits == 0 and misses == 3 and count == 1, 'least recently used forgotten')
+mpfr.memo_flush()
+check(select(3, mpfr.memo_stats()) == 0, 'memo_flush')
+mpfr.memoize(0)
+
+print 'ok'
@@ -0,0 +1,28 @@
+-- Tests for mpfr.newton and mpfr.invert, run as `lua test/newton.lua` with
+-- the module on package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+local c200 = mpfr.context {prec = 200}
+local s = (c200.sqrt((c200.fr(2))))
+local r = mpfr.newton(function(x) return x * x - 2 end,
+                      function(x) return 2 * x end, 1.5, 200)
+check(r:get_prec() == 200 and math.abs((r - s):get_d()) < 2 ^ -195, 'newton')
+r = mpfr.invert(function(x) return x:exp() end,
+                function(x) return x:exp() end, 2, 0.5, 100)
+check(math.abs(r:get_d() - math.log(2)) < 1e-15, 'invert')
+
+-- y is taken exactly, however many bits it needs
+
+local ok, gmp = pcall(require, 'gmp')
+if ok then
+	local y = gmp.z('1267650600228229401496703205377') -- 2^100 + 1
+	r = mpfr.invert(function(x) return x end, function() return 1 end, y, 1, 200)
+	check(r:sub(2 ^ 100) == c200.fr(1), 'invert with an mpz y')
+end
+
+print 'ok'
@@ -0,0 +1,49 @@
+-- Tests for the arithmetic and comparison operators on mpfr values, run as
+-- `lua test/operators.lua` with the module on package.cpath (e.g. after
+-- `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- whether f(...) raises an error containing all the strings in pats
+local function fails(pats, f, ...)
+	local ok, err = pcall(f, ...)
+	if ok then return false end
+	for _, pat in ipairs(pats) do
+		if not tostring(err):find(pat, 1, true) then return false end
+	end
+	return true
+end
+
+local x, y = fr(1) / 3, fr(2):sqrt()
+
+-- the same as the functions of the same name, for every operand type
+
+for _, v in ipairs {y, 3, -3, 0.1} do
+	check(x + v == (x:add(v)) and v + x == (x:add(v)), 'add')
+	check(x - v == (x:sub(v)), 'sub')
+	check(x * v == (x:mul(v)) and v * x == (x:mul(v)), 'mul')
+	check(x / v == (x:div(v)), 'div')
+end
+check(3 - x == (mpfr.fr(3) - x) and 3 / x == (mpfr.fr(3) / x), 'number on the left')
+check(-x == (x:neg()) and x ^ 2 == (x:pow(2)), 'unm and pow')
+check(x < y and x <= y and not (y < x) and x == fr(1) / 3, 'comparisons')
+
+-- passed on to the complex operators
+
+do
+	local z = (mpfr.complex(1, 2))
+	check((x + z):re() == x + 1 and (x - z):im() == fr(-2), 'complex add and sub')
+	check((fr(2) * z):im() == fr(4) and (fr(5) / z):re() == fr(1), 'complex mul and div')
+end
+
+-- errors
+
+check(fails({'#2', 'mpfr, mpz, or number'}, function() return x + {} end), 'add a table')
+check(fails({'#1', 'mpfr'}, function() return {} < x end), 'compare a table')
+
+print 'ok'
@@ -0,0 +1,70 @@
+-- Tests for mpfr.cumsum and mpfr.cumprod, run as `lua test/scan.lua` with
+-- the module on package.cpath (e.g. after `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+-- x rounded to prec bits according to rnd
+local function round(x, prec, rnd)
+	local r = fr(0)
+	r:set_prec(prec); r:set(x, rnd)
+	return r
+end
+
+-- plain values
+
+local s = mpfr.cumsum {1, 2, 3}
+check(s[1] == fr(1) and s[2] == fr(3) and s[3] == fr(6), 'cumsum of numbers')
+local p = mpfr.cumprod {2, fr(3), 0.5, 4}
+check(p[1] == fr(2) and p[2] == fr(6) and p[3] == fr(3) and p[4] == fr(12),
+      'cumprod of numbers and mpfr values')
+
+-- correct rounding after cancellation and in the directed modes
+
+check(mpfr.cumsum({1e30, 1, -1e30}, 53)[3] == fr(1), 'cumsum after cancellation')
+check(mpfr.cumsum({1, -2 ^ -100}, 53, 'D')[2] < fr(1), 'cumsum rounding down')
+check(mpfr.cumsum({1, 2 ^ -100}, 53, 'U')[2] > fr(1), 'cumsum rounding up')
+check(mpfr.cumsum({1, 2 ^ -100}, 53, 'D')[2] == fr(1), 'cumsum rounding down exactly')
+check(mpfr.cumprod({3, 1 / 3}, 53, 'U')[2] == fr(1), 'cumprod of an exact product')
+
+-- against the exact values, with and without threads
+
+math.randomseed(1)
+local exact = mpfr.context {prec = 20000}
+local n0, t0 = mpfr.get_threads()
+for trial = 1, 20 do
+	local xs = {}
+	for i = 1, 150 do
+		local r = math.random()
+		if r < 0.3 then xs[i] = math.random(-5, 5)
+		elseif r < 0.5 then xs[i] = (math.random() - 0.5) * 2 ^ math.random(-60, 60)
+		elseif r < 0.6 and i > 1 then xs[i] = -xs[i - 1]
+		else xs[i] = math.random() + 0.5 end
+	end
+	local prec = math.random(2, 80)
+	for _, prod in ipairs {false, true} do
+		for _, rnd in ipairs {'N', 'Z', 'U', 'D', 'A'} do
+			local one, many
+			mpfr.set_threads(1)
+			one = (prod and mpfr.cumprod or mpfr.cumsum)(xs, prec, rnd)
+			mpfr.set_threads(4, 1)
+			many = (prod and mpfr.cumprod or mpfr.cumsum)(xs, prec, rnd)
+			local acc = (exact.fr(prod and 1 or 0))
+			for i = 1, #xs do
+				if prod then acc = (exact.mul(acc, xs[i]))
+				else acc = (exact.add(acc, xs[i])) end
+				local r = round(acc, prec, rnd)
+				check(r == one[i] or r:zero() and one[i]:zero(), 'correctly rounded scan')
+				check(many[i] == one[i] or r:zero() and many[i]:zero(),
+				      'threaded scan equals the plain one')
+			end
+		end
+	end
+end
+mpfr.set_threads(n0, t0)
+
+print 'ok'
@@ -0,0 +1,31 @@
+-- Tests for mpfr.sort, mpfr.argsort, mpfr.minmax and mpfr.searchsorted, run
+-- as `lua test/sort.lua` with the module on package.cpath (e.g. after
+-- `luarocks make`).
+
+local mpfr = require 'mpfr'
+local function fr(x) return (mpfr.fr(x)) end -- without the ternary value
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+local t = {fr(3), fr(0 / 0), fr(1), fr(2)}
+local idx = mpfr.argsort(t)
+check(idx[1] == 3 and idx[2] == 4 and idx[3] == 1 and idx[4] == 2, 'argsort')
+idx = mpfr.argsort(t, true)
+check(idx[1] == 1 and idx[2] == 4 and idx[3] == 3 and idx[4] == 2,
+      'argsort descending puts NaNs last')
+local lo, hi, ilo, ihi = mpfr.minmax(t)
+check(lo == fr(1) and hi == fr(3) and ilo == 3 and ihi == 1, 'minmax')
+mpfr.sort(t)
+check(t[1] == fr(1) and t[3] == fr(3) and t[4]:nan(), 'sort puts NaNs last')
+check(mpfr.searchsorted(t, 2.5) == 3, 'searchsorted')
+check(mpfr.searchsorted(t, fr(2), 'right') == 3, 'searchsorted right')
+
+-- stable, with signed zeros equal
+local z, nz = fr(0), -fr(0)
+t = {z, fr(-1), nz}
+mpfr.sort(t)
+check(t[1] == fr(-1) and rawequal(t[2], z) and rawequal(t[3], nz), 'sort is stable')
+
+print 'ok'
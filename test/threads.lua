@@ -0,0 +1,77 @@
+-- Tests for mpfr.set_threads, run as `lua test/threads.lua` with the module
+-- on package.cpath (e.g. after `luarocks make`).  Every threaded result and
+-- ternary value must be the same as without threads.
+
+local mpfr = require 'mpfr'
+
+local function check(cond, what)
+	if not cond then error('failed: ' .. what, 2) end
+end
+
+local n0, t0 = mpfr.get_threads()
+check(n0 == 1, 'threads are off initially')
+check(not pcall(mpfr.set_threads, 0), 'thread count out of range')
+
+if not pcall(mpfr.set_threads, 4, 1000) then
+	print 'skipped' -- MPFR is not thread-safe
+	return
+end
+check(select(2, mpfr.get_threads()) == 1000, 'threshold')
+
+-- the result and ternary value of f(...) under 4 threads, then under 1
+local function both(f, ...)
+	local r4, t4 = f(...)
+	mpfr.set_threads(1)
+	local r1, t1 = f(...)
+	mpfr.set_threads(4, 1000)
+	return r4, t4, r1, t1
+end
+
+math.randomseed(1)
+local rnds = {'N', 'Z', 'U', 'D', 'A'}
+for trial = 1, 40 do
+	local px, py, pr = math.random(1000, 9000), math.random(1000, 9000),
+	                   math.random(1000, 9000)
+	local cx, cy = mpfr.context {prec = px}, mpfr.context {prec = py}
+	local x = (cx.div((cx.fr(math.random(1, 1000))), math.random(1, 1000)))
+	local y = (cy.sqrt((cy.fr(math.random(1, 1000)))))
+	if trial % 3 == 0 then x = (cx.neg(x)) end
+	if trial % 5 == 0 then x = (cx.mul_2exp(x, math.random(0, 200))) end
+	local c = mpfr.context {prec = pr}
+	for _, rnd in ipairs(rnds) do
+		for _, f in ipairs {
+			function() return c.mul(x, y, nil, rnd) end,
+			function() return c.div(x, y, nil, rnd) end,
+			function() return c.sqrt(y, nil, rnd) end,
+			function() return c.sqrt((cx.abs(x)), nil, rnd) end,
+		} do
+			local r4, t4, r1, t1 = both(f)
+			check(r4 == r1 and t4 == t1, 'threaded ' .. rnd)
+		end
+	end
+end
+
+-- exact results, with a zero ternary value in every rounding mode
+do
+	local c = mpfr.context {prec = 3000}
+	for _, rnd in ipairs(rnds) do
+		local r4, t4, r1, t1 = both(function() return c.sqrt((c.fr(9)), nil, rnd) end)
+		check(r4 == r1 and t4 == 0 and t1 == 0, 'exact square root ' .. rnd)
+		r4, t4, r1, t1 = both(function() return c.div((c.fr(6)), (c.fr(3)), nil, rnd) end)
+		check(r4 == r1 and t4 == 0 and t1 == 0, 'exact quotient ' .. rnd)
+	end
+end
+
+-- the scans use the same threads
+
+do
+	local xs = {}
+	for i = 1, 200 do xs[i] = math.random() - 0.5 end
+	for _, rnd in ipairs(rnds) do
+		local r4, _, r1 = both(mpfr.cumsum, xs, 2000, rnd)
+		for i = 1, #xs do check(r4[i] == r1[i], 'threaded cumsum ' .. rnd) end
+	end
+end
+
+mpfr.set_threads(n0, t0)
+print 'ok'